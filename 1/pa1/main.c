@@ -128,6 +128,62 @@ int receive_any(void *self, Message *msg) {
     return 0;
 }
 
+enum {
+    BARRIER_ARITY = 2
+};
+
+/** Tree of the children rooted at child 1, heap order with BARRIER_ARITY children per node. */
+static local_id barrier_tree_parent(local_id id) {
+    return (local_id) ((id - 2) / BARRIER_ARITY + 1);
+}
+
+static local_id barrier_first_child(local_id id) {
+    return (local_id) ((id - 1) * BARRIER_ARITY + 2);
+}
+
+/**
+ * A child sends msg up once its subtree has arrived and the root sends its
+ * type back down, 2n messages instead of the n^2 of multicasts. The parent
+ * can't send, so the root reports the whole tree to it instead of releasing.
+ */
+static int barrier_wait(Process *self, const Message *msg) {
+    MessageType type = msg->s_header.s_type;
+    local_id first = barrier_first_child(self->id);
+    local_id end = first + BARRIER_ARITY < self->channels_size ? first + BARRIER_ARITY : self->channels_size;
+    Message received;
+    for (local_id child = first; child < end; child++) {
+        if (receive(self, child, &received) != 0 || received.s_header.s_type != type) {
+            return -1;
+        }
+    }
+    if (self->id == 1) {
+        if (send(self, PARENT_ID, msg) != 0) {
+            return -1;
+        }
+    } else {
+        local_id parent = barrier_tree_parent(self->id);
+        if (send(self, parent, msg) != 0 || receive(self, parent, &received) != 0
+            || received.s_header.s_type != type) {
+            return -1;
+        }
+    }
+
+    Message release = (Message) {
+            .s_header = (MessageHeader) {
+                    .s_magic = MESSAGE_MAGIC,
+                    .s_payload_len = 0,
+                    .s_local_time = 0,
+                    .s_type = type
+            }
+    };
+    for (local_id child = first; child < end; child++) {
+        if (send(self, child, &release) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static void child_code_continue(Process *self) {
     // started
     char str_buffer[1024];
@@ -145,18 +201,11 @@ static void child_code_continue(Process *self) {
             }
     };
     memcpy(start_message.s_payload, str_buffer, str_size);
-    send_multicast(self, &start_message);
 
     // wait all started
-    for (local_id i = 1; i < self->channels_size; i++) {
-        if (i == self->id) {
-            continue;
-        }
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("receive");
-            return;
-        }
+    if (barrier_wait(self, &start_message) != 0) {
+        perror("barrier");
+        return;
     }
     printf(log_received_all_started_fmt, self->id);
     fprintf(event_log_fd, log_received_all_started_fmt, self->id);
@@ -179,18 +228,11 @@ static void child_code_continue(Process *self) {
             }
     };
     memcpy(finish_message.s_payload, str_buffer, str_size);
-    send_multicast(self, &finish_message);
 
     // wait all done
-    for (local_id i = 1; i < self->channels_size; i++) {
-        if (i == self->id) {
-            continue;
-        }
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != DONE) {
-            perror("receive");
-            return;
-        }
+    if (barrier_wait(self, &finish_message) != 0) {
+        perror("barrier");
+        return;
     }
     printf(log_received_all_done_fmt, self->id);
     fprintf(event_log_fd, log_received_all_done_fmt, self->id);
@@ -198,28 +240,20 @@ static void child_code_continue(Process *self) {
 }
 
 static void parent_code_continue(Process *self) {
-    // wait all started
-    for (local_id i = 1; i < self->channels_size; i++) {
-        if (i == self->id) {
-            continue;
-        }
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("receive");
-            return;
-        }
+    if (self->channels_size == 1) {
+        return;
+    }
+    // the root of the barrier tree reports once every child started
+    Message msg;
+    if (receive(self, 1, &msg) != 0 || msg.s_header.s_type != STARTED) {
+        perror("receive");
+        return;
     }
 
-    // wait all done
-    for (local_id i = 1; i < self->channels_size; i++) {
-        if (i == self->id) {
-            continue;
-        }
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != DONE) {
-            perror("receive");
-            return;
-        }
+    // and once every child is done
+    if (receive(self, 1, &msg) != 0 || msg.s_header.s_type != DONE) {
+        perror("receive");
+        return;
     }
 }
 
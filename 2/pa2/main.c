@@ -7,6 +7,8 @@
 #include <sys/param.h>
 
 #include "banking.h"
+#include "barrier.h"
+#include "collective.h"
 #include "common.h"
 #include "process.h"
 #include "pa2345.h"
@@ -112,21 +114,13 @@ static int child_start(Process *self) {
             }
     };
     memcpy(start_message.s_payload, str_buffer, str_size);
-    if (send_multicast(self, &start_message) != 0) {
-        perror("Child multicast");
-        return -1;
-    }
 
     // wait all started
-    for (local_id i = 1; i < self->channels_size; i++) {
-        if (i == self->id) {
-            continue;
-        }
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("Child receive");
-            return -1;
-        }
+    Barrier started;
+    barrier_init(&started, STARTED);
+    if (barrier_wait(self, &started, &start_message) != 0) {
+        perror("Child barrier");
+        return -1;
     }
     time = get_physical_time();
     printf(log_received_all_started_fmt, time, self->id);
@@ -135,6 +129,21 @@ static int child_start(Process *self) {
     return 0;
 }
 
+/** s_history_len is a uint8_t, so the last time that fits is MAX_T - 1. */
+static int history_record(Process *self, timestamp_t time) {
+    if (time < 0 || time >= MAX_T) {
+        fprintf(stderr, "Process %d: time %d is out of the history range [0;%d)\n", self->id, time, MAX_T);
+        return -1;
+    }
+    self->history.s_history[time] = (BalanceState) {
+            .s_balance = self->balance,
+            .s_time = time,
+            .s_balance_pending_in = 0
+    };
+    self->history.s_history_len = time + 1;
+    return 0;
+}
+
 static int child_handle_transfer(Process *self, Message *message) {
     timestamp_t time = get_physical_time();
     TransferOrder *order = (TransferOrder *) message->s_payload;
@@ -143,13 +152,9 @@ static int child_handle_transfer(Process *self, Message *message) {
         fprintf(event_log_fd, log_transfer_out_fmt, time, self->id, order->s_amount, order->s_dst);
         self->balance -= order->s_amount;
 
-        BalanceState state = (BalanceState) {
-                .s_balance = self->balance,
-                .s_time = time,
-                .s_balance_pending_in = 0
-        };
-        self->history.s_history[time] = state;
-        self->history.s_history_len = time + 1;
+        if (history_record(self, time) != 0) {
+            return -1;
+        }
 
         return send(self, order->s_dst, message);
     } else if (self->id == order->s_dst) {
@@ -165,13 +170,9 @@ static int child_handle_transfer(Process *self, Message *message) {
             }
         };
 
-        BalanceState state = (BalanceState) {
-                .s_balance = self->balance,
-                .s_time = time,
-                .s_balance_pending_in = 0
-        };
-        self->history.s_history[time] = state;
-        self->history.s_history_len = time + 1;
+        if (history_record(self, time) != 0) {
+            return -1;
+        }
 
         return send(self, PARENT_ID, &ack_message);
     }
@@ -201,6 +202,10 @@ static int child_work(Process *self) {
             }
         }
     }
+    if (broadcast_forward(self, &message) != 0) {
+        perror("Child broadcast");
+        return -1;
+    }
 
     // send done
     time = get_physical_time();
@@ -218,31 +223,13 @@ static int child_work(Process *self) {
             }
     };
     memcpy(finish_message.s_payload, str_buffer, str_size);
-    if (send_multicast(self, &finish_message) != 0) {
-        perror("Child work multicast");
-        return -1;
-    }
 
-    // receive TRANSFER and DONE
-    for (local_id id = 1; id < self->channels_size; id++) {
-        if (id == self->id) {
-            continue;
-        }
-        Message msg = (Message) {.s_header.s_type = TRANSFER};
-        while (msg.s_header.s_type == TRANSFER) {
-            if (receive(self, id, &msg) != 0) {
-                perror("Child receive: TRANSFER and DONE");
-                return -1;
-            }
-            if (msg.s_header.s_type == TRANSFER) {
-                child_handle_transfer(self, &msg);
-            } else if (msg.s_header.s_type == DONE) {
-                break;
-            } else {
-                fprintf(stderr, "Unexpected message type: %d", msg.s_header.s_type);
-                return -1;
-            }
-        }
+    // wait all done, the parent got ACK of every TRANSFER before STOP so none is in flight
+    Barrier done;
+    barrier_init(&done, DONE);
+    if (barrier_wait(self, &done, &finish_message) != 0) {
+        perror("Child barrier");
+        return -1;
     }
 
     time = get_physical_time();
@@ -251,23 +238,11 @@ static int child_work(Process *self) {
     fflush(event_log_fd);
 
     // send history
-    time = get_physical_time();
     BalanceHistory *history = &self->history;
     size_t history_header_size = sizeof(history->s_id) + sizeof(history->s_history_len);
     size_t history_payload_size = sizeof(history->s_history[0]) * history->s_history_len;
-    size_t history_size = history_header_size + history_payload_size;
-    Message history_message = (Message) {
-            .s_header = (MessageHeader) {
-                    .s_magic = MESSAGE_MAGIC,
-                    .s_payload_len = history_size,
-                    .s_type = BALANCE_HISTORY,
-                    .s_local_time = time
-            }
-    };
-    BalanceHistory* payload = (BalanceHistory *) history_message.s_payload;
-    *payload = *history;
-    if (send(self, PARENT_ID, &history_message) != 0) {
-        perror("Child send: BALANCE_HISTORY");
+    if (gather(self, BALANCE_HISTORY, history, history_header_size + history_payload_size, NULL, NULL) != 0) {
+        perror("Child gather: BALANCE_HISTORY");
         return -1;
     }
 
@@ -309,54 +284,48 @@ static void continue_all_history(AllHistory* all_history) {
     }
 }
 
-static int parent_code(Process *self) {
-    timestamp_t time;
+static void parent_store_history(local_id from, const char *payload, uint16_t len, void *arg) {
+    AllHistory *all_history = (AllHistory *) arg;
+    memcpy(&all_history->s_history[from - 1], payload, len);
+}
 
+static int parent_code(Process *self) {
     // wait all started
-    for (local_id i = 1; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("Parent receive");
-            return -1;
-        }
+    Barrier started;
+    barrier_init(&started, STARTED);
+    if (barrier_wait(self, &started, NULL) != 0) {
+        perror("Parent barrier");
+        return -1;
     }
 
     bank_robbery(self, self->channels_size - 1);
 
     // send stop
-    time = get_physical_time();
     Message message = (Message) {
         .s_header = (MessageHeader) {
             .s_magic = MESSAGE_MAGIC,
             .s_type = STOP,
-            .s_local_time = time,
             .s_payload_len = 0
         }
     };
-    if (send_multicast(self, &message) != 0) {
-        perror("Parent send multicast");
+    if (broadcast(self, &message) != 0) {
+        perror("Parent broadcast");
         return -1;
     }
 
     // wait all done
-    for (local_id i = 1; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != DONE) {
-            perror("Parent receive");
-            return -1;
-        }
+    Barrier done;
+    barrier_init(&done, DONE);
+    if (barrier_wait(self, &done, NULL) != 0) {
+        perror("Parent barrier");
+        return -1;
     }
 
     // get all_history
     AllHistory all_history = (AllHistory) {.s_history_len = self->channels_size - 1};
-    for (local_id i = 1; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != BALANCE_HISTORY) {
-            perror("Parent receive: BALANCE_HISTORY");
-            return -1;
-        }
-        BalanceHistory* balance_history = (BalanceHistory *) msg.s_payload;
-        all_history.s_history[i - 1] = *balance_history;
+    if (gather(self, BALANCE_HISTORY, NULL, 0, parent_store_history, &all_history) != 0) {
+        perror("Parent gather: BALANCE_HISTORY");
+        return -1;
     }
 
     continue_all_history(&all_history);
@@ -154,6 +154,12 @@ int receive_any(void *self, Message *msg) {
     return -1;
 }
 
+/**
+ * Defined only by the fast runtime, which has no hook on write to count the
+ * TRANSFERs of get_physical_time. Called before the write, like that hook.
+ */
+extern void runtime_sent(local_id from, const Message *msg) __attribute__((weak));
+
 int send(void *self, local_id dst, const Message *msg) {
     if (msg->s_header.s_magic != MESSAGE_MAGIC) {
         return -1;
@@ -166,6 +172,9 @@ int send(void *self, local_id dst, const Message *msg) {
         return -1;
     }
 
+    if (runtime_sent != NULL) {
+        runtime_sent(process->id, msg);
+    }
     return channel_write(&process->channels[dst], msg);
 }
 
@@ -0,0 +1,125 @@
+#include <string.h>
+#include <sys/param.h>
+
+#include "balance.h"
+
+size_t balance_encode(char *buffer, balance_t value) {
+#ifndef WIDE_BALANCE
+    memcpy(buffer, &value, sizeof(value));
+    return sizeof(value);
+#else
+    int16_t narrow = (int16_t) value;
+    if (narrow == value && narrow != BALANCE_WIDE_MARK) {
+        memcpy(buffer, &narrow, sizeof(narrow));
+        return sizeof(narrow);
+    }
+    int16_t mark = BALANCE_WIDE_MARK;
+    int64_t wide = value;
+    memcpy(buffer, &mark, sizeof(mark));
+    memcpy(buffer + sizeof(mark), &wide, sizeof(wide));
+    return sizeof(mark) + sizeof(wide);
+#endif
+}
+
+size_t balance_decode(const char *buffer, balance_t *value) {
+#ifndef WIDE_BALANCE
+    memcpy(value, buffer, sizeof(*value));
+    return sizeof(*value);
+#else
+    int16_t narrow;
+    memcpy(&narrow, buffer, sizeof(narrow));
+    if (narrow != BALANCE_WIDE_MARK) {
+        *value = narrow;
+        return sizeof(narrow);
+    }
+    int64_t wide;
+    memcpy(&wide, buffer + sizeof(narrow), sizeof(wide));
+    *value = (balance_t) wide;
+    return sizeof(narrow) + sizeof(wide);
+#endif
+}
+
+size_t transfer_order_encode(char *buffer, const TransferOrder *order) {
+    size_t ptr = 0;
+    memcpy(buffer + ptr, &order->s_src, sizeof(order->s_src));
+    ptr += sizeof(order->s_src);
+    memcpy(buffer + ptr, &order->s_dst, sizeof(order->s_dst));
+    ptr += sizeof(order->s_dst);
+    ptr += balance_encode(buffer + ptr, order->s_amount);
+    return ptr;
+}
+
+size_t transfer_order_decode(const char *buffer, TransferOrder *order) {
+    size_t ptr = 0;
+    memcpy(&order->s_src, buffer + ptr, sizeof(order->s_src));
+    ptr += sizeof(order->s_src);
+    memcpy(&order->s_dst, buffer + ptr, sizeof(order->s_dst));
+    ptr += sizeof(order->s_dst);
+    balance_t amount;
+    ptr += balance_decode(buffer + ptr, &amount);
+    order->s_amount = amount;
+    return ptr;
+}
+
+size_t balance_state_encode(char *buffer, const BalanceState *state) {
+    size_t ptr = 0;
+    ptr += balance_encode(buffer + ptr, state->s_balance);
+    memcpy(buffer + ptr, &state->s_time, sizeof(state->s_time));
+    ptr += sizeof(state->s_time);
+    ptr += balance_encode(buffer + ptr, state->s_balance_pending_in);
+    return ptr;
+}
+
+size_t balance_state_decode(const char *buffer, BalanceState *state) {
+    size_t ptr = 0;
+    balance_t value;
+    ptr += balance_decode(buffer + ptr, &value);
+    state->s_balance = value;
+    memcpy(&state->s_time, buffer + ptr, sizeof(state->s_time));
+    ptr += sizeof(state->s_time);
+    ptr += balance_decode(buffer + ptr, &value);
+    state->s_balance_pending_in = value;
+    return ptr;
+}
+
+size_t balance_history_encode(char *buffer, const BalanceHistory *history, size_t first, size_t count) {
+    uint8_t part_first = (uint8_t) MIN(first, history->s_history_len);
+    uint8_t part_count = (uint8_t) (MIN(first + count, history->s_history_len) - part_first);
+    size_t ptr = 0;
+    memcpy(buffer + ptr, &history->s_id, sizeof(history->s_id));
+    ptr += sizeof(history->s_id);
+    memcpy(buffer + ptr, &history->s_history_len, sizeof(history->s_history_len));
+    ptr += sizeof(history->s_history_len);
+#ifdef WIDE_BALANCE
+    memcpy(buffer + ptr, &part_first, sizeof(part_first));
+    ptr += sizeof(part_first);
+    memcpy(buffer + ptr, &part_count, sizeof(part_count));
+    ptr += sizeof(part_count);
+#endif
+    for (size_t t = part_first; t < (size_t) part_first + part_count; t++) {
+        ptr += balance_state_encode(buffer + ptr, &history->s_history[t]);
+    }
+    return ptr;
+}
+
+void balance_history_decode(const char *buffer, BalanceHistory *history) {
+    size_t ptr = 0;
+    memcpy(&history->s_id, buffer + ptr, sizeof(history->s_id));
+    ptr += sizeof(history->s_id);
+    memcpy(&history->s_history_len, buffer + ptr, sizeof(history->s_history_len));
+    ptr += sizeof(history->s_history_len);
+#ifdef WIDE_BALANCE
+    uint8_t part_first;
+    uint8_t part_count;
+    memcpy(&part_first, buffer + ptr, sizeof(part_first));
+    ptr += sizeof(part_first);
+    memcpy(&part_count, buffer + ptr, sizeof(part_count));
+    ptr += sizeof(part_count);
+#else
+    uint8_t part_first = 0;
+    uint8_t part_count = history->s_history_len;
+#endif
+    for (size_t t = part_first; t < (size_t) part_first + part_count; t++) {
+        ptr += balance_state_decode(buffer + ptr, &history->s_history[t]);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef PROGRAM_BALANCE_H
+#define PROGRAM_BALANCE_H
+
+#include <inttypes.h>
+
+#include "banking.h"
+#include "pa2345.h"
+
+/**
+ * The wide build sends balances as int16 when they fit, otherwise as
+ * BALANCE_WIDE_MARK followed by int64, so typical messages keep their narrow
+ * size. The narrow build sends the plain int16, so its messages have the
+ * layout of the lab structures and a whole history fits into one message.
+ */
+enum {
+#ifdef WIDE_BALANCE
+    BALANCE_WIDE_MARK = INT16_MIN,
+    BALANCE_MAX_ENCODED_SIZE = sizeof(int16_t) + sizeof(int64_t),
+    BALANCE_HISTORY_HEADER_SIZE = sizeof(local_id) + 3 * sizeof(uint8_t), ///< id, length, first and count
+#else
+    BALANCE_MAX_ENCODED_SIZE = sizeof(int16_t),
+    BALANCE_HISTORY_HEADER_SIZE = sizeof(local_id) + sizeof(uint8_t), ///< id and length
+#endif
+    BALANCE_STATE_MAX_ENCODED_SIZE = 2 * BALANCE_MAX_ENCODED_SIZE + sizeof(timestamp_t)
+};
+
+#ifdef WIDE_BALANCE
+static const char * const balance_log_started_fmt =
+    "%d: process %1d (pid %5d, parent %5d) has STARTED with balance $%2" PRId64 "\n";
+
+static const char * const balance_log_done_fmt =
+    "%d: process %1d has DONE with balance $%2" PRId64 "\n";
+
+static const char * const balance_log_transfer_out_fmt =
+    "%d: process %1d transferred $%2" PRId64 " to process %1d\n";
+
+static const char * const balance_log_transfer_in_fmt =
+    "%d: process %1d received $%2" PRId64 " from process %1d\n";
+#else
+#define balance_log_started_fmt log_started_fmt
+#define balance_log_done_fmt log_done_fmt
+#define balance_log_transfer_out_fmt log_transfer_out_fmt
+#define balance_log_transfer_in_fmt log_transfer_in_fmt
+#endif
+
+size_t balance_encode(char *buffer, balance_t value);
+
+size_t balance_decode(const char *buffer, balance_t *value);
+
+size_t transfer_order_encode(char *buffer, const TransferOrder *order);
+
+size_t transfer_order_decode(const char *buffer, TransferOrder *order);
+
+size_t balance_state_encode(char *buffer, const BalanceState *state);
+
+size_t balance_state_decode(const char *buffer, BalanceState *state);
+
+/**
+ * Encode states [first; first + count) of history, those past its length are
+ * left out, so a long wide history is sent in parts. The narrow build has no
+ * parts, it encodes the whole history as a plain BalanceHistory and needs
+ * first 0 and count of at least the length. buffer must hold
+ * BALANCE_HISTORY_HEADER_SIZE + count * BALANCE_STATE_MAX_ENCODED_SIZE bytes.
+ * @return encoded size
+ */
+size_t balance_history_encode(char *buffer, const BalanceHistory *history, size_t first, size_t count);
+
+/** Decode a part of history into its place, the other states are kept. */
+void balance_history_decode(const char *buffer, BalanceHistory *history);
+
+#endif //PROGRAM_BALANCE_H
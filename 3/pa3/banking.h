@@ -12,7 +12,11 @@
 
 #include "ipc.h"
 
+#ifdef WIDE_BALANCE
+typedef int64_t balance_t;
+#else
 typedef int16_t balance_t;
+#endif
 
 /**
  * 1. "Main process" sends TransferOrder to process with id=s_src.
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "barrier.h"
+#include "process.h"
+
+extern timestamp_t local_time;
+
+local_id tree_parent(local_id id) {
+    return (local_id) ((id - 1) / BARRIER_ARITY);
+}
+
+local_id tree_first_child(local_id id) {
+    return (local_id) (id * BARRIER_ARITY + 1);
+}
+
+local_id tree_children(local_id id, local_id size) {
+    local_id first = tree_first_child(id);
+    return first < size ? MIN(BARRIER_ARITY, size - first) : 0;
+}
+
+static int barrier_send(Process *self, local_id dst, Message *msg) {
+    local_time++;
+    msg->s_header.s_local_time = get_lamport_time();
+    return send(self, dst, msg);
+}
+
+static int release(Process *self, Barrier *barrier) {
+    barrier->released = true;
+    Message msg = (Message) {
+            .s_header = (MessageHeader) {
+                    .s_magic = MESSAGE_MAGIC,
+                    .s_payload_len = 0,
+                    .s_type = barrier->type
+            }
+    };
+    local_id first = tree_first_child(self->id);
+    for (local_id i = 0; i < tree_children(self->id, self->channels_size); i++) {
+        if (barrier_send(self, (local_id) (first + i), &msg) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/** Up once the process and its whole subtree arrived, the parent releases instead. */
+static int try_complete(Process *self, Barrier *barrier) {
+    if (!barrier->self_arrived || barrier->arrived != tree_children(self->id, self->channels_size)) {
+        return 0;
+    }
+    if (self->id == PARENT_ID) {
+        return release(self, barrier);
+    }
+    return barrier_send(self, tree_parent(self->id), &barrier->message);
+}
+
+void barrier_init(Barrier *barrier, MessageType type) {
+    barrier->type = type;
+    barrier->arrived = 0;
+    barrier->self_arrived = false;
+    barrier->released = false;
+}
+
+int barrier_arrive(void *ptr, Barrier *barrier, const Message *msg) {
+    Process *self = (Process *) ptr;
+    if (msg != NULL) {
+        memcpy(&barrier->message, msg, sizeof(MessageHeader) + msg->s_header.s_payload_len);
+    }
+    barrier->self_arrived = true;
+    return try_complete(self, barrier);
+}
+
+int barrier_handle(void *ptr, Barrier *barrier, local_id from, const Message *msg) {
+    Process *self = (Process *) ptr;
+    local_id first = tree_first_child(self->id);
+    if (msg->s_header.s_type != barrier->type) {
+        fprintf(stderr, "Process %d: message %d from %d in barrier %d\n", self->id, msg->s_header.s_type, from,
+                barrier->type);
+        return -1;
+    }
+    if (self->id != PARENT_ID && from == tree_parent(self->id)) {
+        return release(self, barrier);
+    }
+    if (from < first || from >= first + tree_children(self->id, self->channels_size)) {
+        fprintf(stderr, "Process %d: barrier %d from %d out of the tree\n", self->id, barrier->type, from);
+        return -1;
+    }
+    barrier->arrived++;
+    return try_complete(self, barrier);
+}
+
+int barrier_wait(void *ptr, Barrier *barrier, const Message *msg) {
+    Process *self = (Process *) ptr;
+    if (barrier_arrive(self, barrier, msg) != 0) {
+        return -1;
+    }
+    while (!barrier->released) {
+        // the subtree in order, then the release from above
+        local_id from = barrier->arrived < tree_children(self->id, self->channels_size)
+                        ? (local_id) (tree_first_child(self->id) + barrier->arrived)
+                        : tree_parent(self->id);
+        Message received;
+        if (receive(self, from, &received) != 0 || barrier_handle(self, barrier, from, &received) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef PROGRAM_BARRIER_H
+#define PROGRAM_BARRIER_H
+
+#include <stdbool.h>
+
+#include "ipc.h"
+
+enum {
+    BARRIER_ARITY = 2   ///< tree children of a process, id * BARRIER_ARITY + 1 and on
+};
+
+/**
+ * Tree barrier over the parent and its children rooted at the parent: a
+ * process sends its STARTED or DONE up once its subtree has arrived and the
+ * parent sends the type back down, 2n messages per phase instead of n^2
+ * multicasts. Once released, every process of the run has arrived.
+ */
+typedef struct {
+    MessageType type;
+    local_id arrived;      ///< tree children whose subtree arrived
+    bool self_arrived;
+    bool released;
+    Message message;       ///< own message, sent up once the subtree arrives
+} Barrier;
+
+/** The tree of the barrier and of the collectives, heap ordered from the parent. */
+local_id tree_parent(local_id id);
+
+local_id tree_first_child(local_id id);
+
+/** Tree children of id when there are size processes. */
+local_id tree_children(local_id id, local_id size);
+
+void barrier_init(Barrier *barrier, MessageType type);
+
+/** Arrive with the own message of the process, NULL for the parent. */
+int barrier_arrive(void *self, Barrier *barrier, const Message *msg);
+
+/** Handle a message of the barrier type from a tree neighbour. */
+int barrier_handle(void *self, Barrier *barrier, local_id from, const Message *msg);
+
+/** Arrive and block until released, nothing but the barrier may come from the tree neighbours meanwhile. */
+int barrier_wait(void *self, Barrier *barrier, const Message *msg);
+
+#endif //PROGRAM_BARRIER_H
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "barrier.h"
+#include "collective.h"
+#include "process.h"
+
+extern timestamp_t local_time;
+
+/** Items on their way to the tree parent. */
+typedef struct {
+    Process *self;
+    Message msg;
+} Packer;
+
+typedef int (*item_visitor)(void *ctx, local_id id, const char *payload, uint16_t len);
+
+/** Items that reach the callback of a gather. */
+typedef struct {
+    gather_callback callback;
+    void *arg;
+} Delivery;
+
+static int collective_send(Process *self, local_id dst, Message *msg) {
+    local_time++;
+    msg->s_header.s_local_time = get_lamport_time();
+    return send(self, dst, msg);
+}
+
+static int send_down(Process *self, Message *msg) {
+    local_id first = tree_first_child(self->id);
+    for (local_id i = 0; i < tree_children(self->id, self->channels_size); i++) {
+        if (collective_send(self, (local_id) (first + i), msg) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/** Processes in the subtree of id, id included. */
+static local_id subtree_size(local_id id, local_id size) {
+    int count = 0;
+    int first = id;
+    int last = id;
+    while (first < size) {
+        count += MIN(last, size - 1) - first + 1;
+        first = first * BARRIER_ARITY + 1;
+        last = last * BARRIER_ARITY + BARRIER_ARITY;
+    }
+    return (local_id) count;
+}
+
+static void packer_init(Packer *packer, Process *self, MessageType type) {
+    packer->self = self;
+    packer->msg.s_header = (MessageHeader) {
+            .s_magic = MESSAGE_MAGIC,
+            .s_payload_len = 0,
+            .s_type = type
+    };
+}
+
+static int packer_flush(Packer *packer) {
+    if (packer->msg.s_header.s_payload_len == 0) {
+        return 0;
+    }
+    int result = collective_send(packer->self, tree_parent(packer->self->id), &packer->msg);
+    packer->msg.s_header.s_payload_len = 0;
+    return result;
+}
+
+/** Append an item, sending what is packed first if it doesn't fit. */
+static int packer_add(void *ctx, local_id id, const char *payload, uint16_t len) {
+    Packer *packer = (Packer *) ctx;
+    MessageHeader *header = &packer->msg.s_header;
+    if (len > GATHER_MAX_ITEM_LEN) {
+        fprintf(stderr, "Process %d: item of %d bytes doesn't fit into a message\n", packer->self->id, len);
+        return -1;
+    }
+    if (header->s_payload_len + sizeof(GatherItem) + len > MAX_PAYLOAD_LEN && packer_flush(packer) != 0) {
+        return -1;
+    }
+    GatherItem item = (GatherItem) {
+            .s_id = id,
+            .s_len = len
+    };
+    memcpy(packer->msg.s_payload + header->s_payload_len, &item, sizeof(item));
+    memcpy(packer->msg.s_payload + header->s_payload_len + sizeof(item), payload, len);
+    header->s_payload_len += sizeof(item) + len;
+    return 0;
+}
+
+static int deliver(void *ctx, local_id id, const char *payload, uint16_t len) {
+    Delivery *delivery = (Delivery *) ctx;
+    delivery->callback(id, payload, len, delivery->arg);
+    return 0;
+}
+
+/** Visit count items of type that come packed from one neighbour. */
+static int receive_items(Process *self, local_id from, MessageType type, local_id count, item_visitor visit,
+                         void *ctx) {
+    while (count > 0) {
+        Message msg;
+        if (receive(self, from, &msg) != 0 || msg.s_header.s_type != type) {
+            fprintf(stderr, "Process %d: expected items of type %d from %d\n", self->id, type, from);
+            return -1;
+        }
+        size_t offset = 0;
+        while (offset < msg.s_header.s_payload_len) {
+            GatherItem item;
+            if (count == 0 || offset + sizeof(item) > msg.s_header.s_payload_len) {
+                fprintf(stderr, "Process %d: malformed items from %d\n", self->id, from);
+                return -1;
+            }
+            memcpy(&item, msg.s_payload + offset, sizeof(item));
+            offset += sizeof(item);
+            if (offset + item.s_len > msg.s_header.s_payload_len) {
+                fprintf(stderr, "Process %d: malformed items from %d\n", self->id, from);
+                return -1;
+            }
+            if (visit(ctx, item.s_id, msg.s_payload + offset, item.s_len) != 0) {
+                return -1;
+            }
+            offset += item.s_len;
+            count--;
+        }
+    }
+    return 0;
+}
+
+/** Items of the subtree go up packed, the parent visits them instead. */
+static int gather_up(Process *self, MessageType type, const void *payload, uint16_t len, item_visitor visit,
+                     void *ctx) {
+    Packer up;
+    if (self->id != PARENT_ID) {
+        packer_init(&up, self, type);
+        if (packer_add(&up, self->id, payload, len) != 0) {
+            return -1;
+        }
+        visit = packer_add;
+        ctx = &up;
+    }
+    local_id first = tree_first_child(self->id);
+    for (local_id i = 0; i < tree_children(self->id, self->channels_size); i++) {
+        local_id child = (local_id) (first + i);
+        if (receive_items(self, child, type, subtree_size(child, self->channels_size), visit, ctx) != 0) {
+            return -1;
+        }
+    }
+    return self->id != PARENT_ID ? packer_flush(&up) : 0;
+}
+
+int broadcast(void *ptr, Message *msg) {
+    Process *self = (Process *) ptr;
+    if (self->id != PARENT_ID && receive(self, tree_parent(self->id), msg) != 0) {
+        return -1;
+    }
+    return broadcast_forward(self, msg);
+}
+
+int broadcast_forward(void *ptr, const Message *msg) {
+    Process *self = (Process *) ptr;
+    Message copy;
+    memcpy(&copy, msg, sizeof(MessageHeader) + msg->s_header.s_payload_len);
+    return send_down(self, &copy);
+}
+
+int gather(void *ptr, MessageType type, const void *payload, uint16_t len, gather_callback callback, void *arg) {
+    Delivery delivery = (Delivery) {
+            .callback = callback,
+            .arg = arg
+    };
+    return gather_up((Process *) ptr, type, payload, len, deliver, &delivery);
+}
+
+int reduce(void *ptr, MessageType type, void *value, uint16_t size, reduce_combiner combine) {
+    Process *self = (Process *) ptr;
+    if (size > MAX_PAYLOAD_LEN) {
+        fprintf(stderr, "Process %d: value of %d bytes doesn't fit into a message\n", self->id, size);
+        return -1;
+    }
+    // payloads are packed, combine gets an aligned copy
+    uint64_t aligned[MAX_PAYLOAD_LEN / sizeof(uint64_t) + 1];
+    local_id first = tree_first_child(self->id);
+    for (local_id i = 0; i < tree_children(self->id, self->channels_size); i++) {
+        Message msg;
+        local_id child = (local_id) (first + i);
+        if (receive(self, child, &msg) != 0 || msg.s_header.s_type != type || msg.s_header.s_payload_len != size) {
+            fprintf(stderr, "Process %d: expected value of type %d from %d\n", self->id, type, child);
+            return -1;
+        }
+        memcpy(aligned, msg.s_payload, size);
+        combine(value, aligned);
+    }
+    if (self->id == PARENT_ID) {
+        return 0;
+    }
+    Message msg = (Message) {
+            .s_header = (MessageHeader) {
+                    .s_magic = MESSAGE_MAGIC,
+                    .s_payload_len = size,
+                    .s_type = type
+            }
+    };
+    memcpy(msg.s_payload, value, size);
+    return collective_send(self, tree_parent(self->id), &msg);
+}
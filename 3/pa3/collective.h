@@ -0,0 +1,49 @@
+#ifndef PROGRAM_COLLECTIVE_H
+#define PROGRAM_COLLECTIVE_H
+
+#include <stdint.h>
+
+#include "ipc.h"
+
+/**
+ * Collectives over the tree of the barrier rooted at the parent. Every
+ * process of the run calls the same ones in the same order and talks only to
+ * its tree neighbours, so the parent receives from BARRIER_ARITY children
+ * instead of looping over all of them.
+ */
+
+/** Header of an item of a gather message, len bytes of the payload follow. */
+typedef struct {
+    local_id s_id;
+    uint16_t s_len;
+} __attribute__((packed)) GatherItem;
+
+enum {
+    GATHER_MAX_ITEM_LEN = MAX_PAYLOAD_LEN - sizeof(GatherItem) ///< payload of one process
+};
+
+typedef void (*gather_callback)(local_id from, const char *payload, uint16_t len, void *arg);
+
+/** Fold value into accumulator, value is aligned for any scalar. */
+typedef void (*reduce_combiner)(void *accumulator, const void *value);
+
+/** The parent sends msg, the others receive it into msg and pass it down. */
+int broadcast(void *self, Message *msg);
+
+/** Pass down msg that arrived from the tree parent elsewhere, e.g. in a receive_any loop. */
+int broadcast_forward(void *self, const Message *msg);
+
+/**
+ * The payload of every child reaches callback at the parent, which passes
+ * no payload of its own. A subtree travels up packed into as few messages of
+ * type as it fits in, so variable sizes cost no padding.
+ */
+int gather(void *self, MessageType type, const void *payload, uint16_t len, gather_callback callback, void *arg);
+
+/**
+ * Every process passes its value of size bytes, the parent passes the
+ * identity of combine and gets the combination of all of them back in value.
+ */
+int reduce(void *self, MessageType type, void *value, uint16_t size, reduce_combiner combine);
+
+#endif //PROGRAM_COLLECTIVE_H
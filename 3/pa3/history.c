@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "history.h"
+
+typedef history_value_t history_vector __attribute__((vector_size(HISTORY_VECTOR_SIZE), may_alias));
+
+static size_t vector_len(size_t len) {
+    return (len + HISTORY_VECTOR_LANES - 1) / HISTORY_VECTOR_LANES * HISTORY_VECTOR_LANES;
+}
+
+static void fill_run(history_value_t *row, size_t from, size_t to, history_value_t value) {
+    history_vector vector = (history_vector) {0} + value;
+    while (from < to && from % HISTORY_VECTOR_LANES != 0) {
+        row[from++] = value;
+    }
+    for (; from + HISTORY_VECTOR_LANES <= to; from += HISTORY_VECTOR_LANES) {
+        *(history_vector *) &row[from] = vector;
+    }
+    while (from < to) {
+        row[from++] = value;
+    }
+}
+
+static void load_history(HistoryColumns *columns, size_t p, const BalanceHistory *history) {
+    history_value_t *balance = columns->balance[p];
+    history_value_t *pending = columns->pending[p];
+    size_t last = 0;
+    balance[0] = history->s_history[0].s_balance;
+    pending[0] = history->s_history[0].s_balance_pending_in;
+    for (size_t t = 1; t < history->s_history_len; t++) {
+        const BalanceState *state = &history->s_history[t];
+        if (state->s_time == -1) {
+            continue;
+        }
+        fill_run(balance, last + 1, t, balance[last]);
+        fill_run(pending, last + 1, t, pending[last]);
+        balance[t] = state->s_balance;
+        pending[t] = state->s_balance_pending_in;
+        last = t;
+    }
+    fill_run(balance, last + 1, columns->time_len, balance[last]);
+    fill_run(pending, last + 1, columns->time_len, pending[last]);
+}
+
+void history_columns_load(HistoryColumns *columns, const AllHistory *history) {
+    memset(columns, 0, sizeof(HistoryColumns));
+    columns->processes_len = history->s_history_len;
+    for (size_t p = 0; p < history->s_history_len; p++) {
+        columns->time_len = MAX(columns->time_len, history->s_history[p].s_history_len);
+    }
+    for (size_t p = 0; p < history->s_history_len; p++) {
+        load_history(columns, p, &history->s_history[p]);
+    }
+}
+
+void history_columns_totals(HistoryColumns *columns) {
+    size_t len = vector_len(columns->time_len);
+    for (size_t t = 0; t < len; t += HISTORY_VECTOR_LANES) {
+        history_vector total = {0};
+        for (size_t p = 0; p < columns->processes_len; p++) {
+            total += *(const history_vector *) &columns->balance[p][t];
+            total += *(const history_vector *) &columns->pending[p][t];
+        }
+        *(history_vector *) &columns->total[t] = total;
+    }
+}
+
+void history_columns_store(const HistoryColumns *columns, AllHistory *history) {
+    history->s_history_len = columns->processes_len;
+    for (size_t p = 0; p < columns->processes_len; p++) {
+        BalanceHistory *balance_history = &history->s_history[p];
+        balance_history->s_history_len = columns->time_len;
+        for (size_t t = 0; t < columns->time_len; t++) {
+            balance_history->s_history[t] = (BalanceState) {
+                    .s_balance = (balance_t) columns->balance[p][t],
+                    .s_time = (timestamp_t) t,
+                    .s_balance_pending_in = (balance_t) columns->pending[p][t]
+            };
+        }
+    }
+}
+
+static int print_cell(char *buffer, history_value_t balance, history_value_t pending, bool with_pending) {
+    if (with_pending) {
+        return sprintf(buffer, "%" PRId64 " (%" PRId64 ")", (int64_t) balance, (int64_t) pending);
+    }
+    return sprintf(buffer, "%" PRId64, (int64_t) balance);
+}
+
+static void print_line(size_t width, size_t time_len) {
+    for (size_t i = 0; i < (width + 3) * (time_len + 1); i++) {
+        putchar('-');
+    }
+    putchar('\n');
+}
+
+void history_columns_print(const HistoryColumns *columns) {
+    char buffer[64];
+    bool with_pending = false;
+    size_t width = strlen("Proc \\ time");
+    for (size_t p = 0; p < columns->processes_len; p++) {
+        for (size_t t = 0; t < columns->time_len; t++) {
+            with_pending = with_pending || columns->pending[p][t] != 0;
+        }
+    }
+    for (size_t p = 0; p < columns->processes_len; p++) {
+        for (size_t t = 0; t < columns->time_len; t++) {
+            width = MAX(width, print_cell(buffer, columns->balance[p][t], columns->pending[p][t], with_pending));
+        }
+    }
+    for (size_t t = 0; t < columns->time_len; t++) {
+        width = MAX(width, print_cell(buffer, columns->total[t], 0, false));
+    }
+
+    printf("Full balance history for time range [0;%d], %s:\n",
+           columns->time_len - 1, with_pending ? "$balance ($pending)" : "$balance");
+    print_line(width, columns->time_len);
+    printf("%*s |", (int) width, "Proc \\ time");
+    for (size_t t = 0; t < columns->time_len; t++) {
+        printf(" %*zu |", (int) width, t);
+    }
+    putchar('\n');
+    print_line(width, columns->time_len);
+    for (size_t p = 0; p < columns->processes_len; p++) {
+        printf("%*zu |", (int) width, p + 1);
+        for (size_t t = 0; t < columns->time_len; t++) {
+            print_cell(buffer, columns->balance[p][t], columns->pending[p][t], with_pending);
+            printf(" %*s |", (int) width, buffer);
+        }
+        putchar('\n');
+        print_line(width, columns->time_len);
+    }
+    printf("%*s |", (int) width, "Total");
+    for (size_t t = 0; t < columns->time_len; t++) {
+        printf(" %*" PRId64 " |", (int) width, (int64_t) columns->total[t]);
+    }
+    putchar('\n');
+    print_line(width, columns->time_len);
+}
@@ -0,0 +1,42 @@
+#ifndef PROGRAM_HISTORY_H
+#define PROGRAM_HISTORY_H
+
+#include "banking.h"
+
+#ifdef WIDE_BALANCE
+typedef int64_t history_value_t;
+#else
+typedef int32_t history_value_t;
+#endif
+
+enum {
+    HISTORY_VECTOR_SIZE = 16,
+    HISTORY_VECTOR_LANES = HISTORY_VECTOR_SIZE / sizeof(history_value_t),
+    HISTORY_TIME_LEN = MAX_T + 1
+};
+
+/**
+ * Structure-of-arrays copy of AllHistory. Every row is aligned and padded to
+ * a whole number of vectors, rows of process with id=p are stored at p - 1.
+ */
+typedef struct {
+    uint8_t processes_len;
+    uint8_t time_len;
+    history_value_t balance[MAX_PROCESS_ID][HISTORY_TIME_LEN] __attribute__((aligned(HISTORY_VECTOR_SIZE)));
+    history_value_t pending[MAX_PROCESS_ID][HISTORY_TIME_LEN] __attribute__((aligned(HISTORY_VECTOR_SIZE)));
+    history_value_t total[HISTORY_TIME_LEN] __attribute__((aligned(HISTORY_VECTOR_SIZE)));
+} HistoryColumns;
+
+/** Load histories and fill the gaps between recorded states up to the longest history. */
+void history_columns_load(HistoryColumns *columns, const AllHistory *history);
+
+/** Compute total of balances and pending balances at each time. */
+void history_columns_totals(HistoryColumns *columns);
+
+/** Store filled histories back, e.g. for print_history. */
+void history_columns_store(const HistoryColumns *columns, AllHistory *history);
+
+/** Same table as print_history, for balances that don't fit into its int16 layout. */
+void history_columns_print(const HistoryColumns *columns);
+
+#endif //PROGRAM_HISTORY_H
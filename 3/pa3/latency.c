@@ -0,0 +1,180 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "latency.h"
+
+extern local_id current_id;
+
+static const char *const latency_names[LATENCY_KINDS] = {
+        [LATENCY_MESSAGE] = "message",
+        [LATENCY_TRANSFER] = "transfer"
+};
+
+static bool enabled = false;
+static Latency *latencies = NULL;
+static local_id latencies_size = 0;
+static SendStamp *stamps = NULL;
+// channels are FIFO, the k-th message read is the k-th sent
+static uint64_t sent_count[MAX_PROCESS_ID + 1];
+static uint64_t received_count[MAX_PROCESS_ID + 1];
+
+static size_t stamps_size(local_id n) {
+    return sizeof(SendStamp) * n * n * LATENCY_STAMPS;
+}
+
+static SendStamp *stamp_of(local_id src, local_id dst, uint64_t seq) {
+    return &stamps[((size_t) src * latencies_size + dst) * LATENCY_STAMPS + seq % LATENCY_STAMPS];
+}
+
+static size_t bucket_of(uint64_t ns) {
+    if (ns < HISTOGRAM_SUB_BUCKETS) {
+        return ns;
+    }
+    int bits = 63 - __builtin_clzll(ns);
+    size_t index = (size_t) (bits - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS
+                   + ((ns >> (bits - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return MIN(index, HISTOGRAM_BUCKETS - 1);
+}
+
+static uint64_t bucket_floor(size_t index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    int bits = (int) (index / HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BITS - 1;
+    return (uint64_t) (HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << (bits - HISTOGRAM_SUB_BITS);
+}
+
+void histogram_record(Histogram *histogram, uint64_t ns) {
+    histogram->buckets[bucket_of(ns)]++;
+    histogram->count++;
+    histogram->max = MAX(histogram->max, ns);
+}
+
+void histogram_merge(Histogram *into, const Histogram *from) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+    into->count += from->count;
+    into->max = MAX(into->max, from->max);
+}
+
+uint64_t histogram_percentile(const Histogram *histogram, double p) {
+    double exact_rank = p * (double) histogram->count;
+    uint64_t rank = (uint64_t) exact_rank;
+    if (rank < exact_rank) {
+        rank++;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank && seen > 0) {
+            return MIN(bucket_floor(i + 1) - 1, histogram->max);
+        }
+    }
+    return histogram->max;
+}
+
+void latency_enable(void) {
+    enabled = true;
+}
+
+bool latency_enabled(void) {
+    return latencies != NULL;
+}
+
+int latency_open(local_id n) {
+    if (!enabled) {
+        return 0;
+    }
+    latencies = mmap(NULL, sizeof(Latency) * n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (latencies == MAP_FAILED) {
+        latencies = NULL;
+        perror("mmap");
+        return -1;
+    }
+    memset(latencies, 0, sizeof(Latency) * n);
+    stamps = mmap(NULL, stamps_size(n), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stamps == MAP_FAILED) {
+        stamps = NULL;
+        munmap(latencies, sizeof(Latency) * n);
+        latencies = NULL;
+        perror("mmap");
+        return -1;
+    }
+    latencies_size = n;
+    return 0;
+}
+
+void latency_record(LatencyKind kind, uint64_t ns) {
+    if (latencies != NULL) {
+        histogram_record(&latencies[current_id].kinds[kind], ns);
+    }
+}
+
+void latency_sent(local_id dst, uint64_t ns) {
+    if (stamps == NULL) {
+        return;
+    }
+    uint64_t seq = sent_count[dst]++;
+    SendStamp *stamp = stamp_of(current_id, dst, seq);
+    // the slot is invalid while it is rewritten
+    __atomic_store_n(&stamp->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&stamp->ns, ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&stamp->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+void latency_received(local_id src, uint64_t ns) {
+    if (stamps == NULL) {
+        return;
+    }
+    uint64_t seq = received_count[src]++;
+    SendStamp *stamp = stamp_of(src, current_id, seq);
+    uint64_t before = __atomic_load_n(&stamp->seq, __ATOMIC_ACQUIRE);
+    uint64_t sent_ns = __atomic_load_n(&stamp->ns, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t after = __atomic_load_n(&stamp->seq, __ATOMIC_RELAXED);
+    // a sender LATENCY_STAMPS messages ahead has reused the slot
+    if (before == seq + 1 && after == seq + 1) {
+        latency_record(LATENCY_MESSAGE, ns - sent_ns);
+    }
+}
+
+static void print_histogram(FILE *fd, const char *process, LatencyKind kind, const Histogram *histogram) {
+    if (histogram->count == 0) {
+        return;
+    }
+    fprintf(fd, "latency: process %s %s count %lu p50 %.1f us p99 %.1f us p999 %.1f us max %.1f us\n",
+            process, latency_names[kind], (unsigned long) histogram->count,
+            histogram_percentile(histogram, 0.5) / 1000.0, histogram_percentile(histogram, 0.99) / 1000.0,
+            histogram_percentile(histogram, 0.999) / 1000.0, histogram->max / 1000.0);
+}
+
+void latency_print(FILE *fd) {
+    if (latencies == NULL) {
+        return;
+    }
+    for (LatencyKind kind = 0; kind < LATENCY_KINDS; kind++) {
+        Histogram merged = {0};
+        for (local_id id = 0; id < latencies_size; id++) {
+            char process[8];
+            sprintf(process, "%d", id);
+            print_histogram(fd, process, kind, &latencies[id].kinds[kind]);
+            histogram_merge(&merged, &latencies[id].kinds[kind]);
+        }
+        print_histogram(fd, "all", kind, &merged);
+    }
+}
+
+void latency_close(void) {
+    if (latencies != NULL) {
+        munmap(latencies, sizeof(Latency) * latencies_size);
+        munmap(stamps, stamps_size(latencies_size));
+        latencies = NULL;
+        stamps = NULL;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef PROGRAM_LATENCY_H
+#define PROGRAM_LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ipc.h"
+
+/**
+ * Log-linear buckets: exact below HISTOGRAM_SUB_BUCKETS ns, then
+ * HISTOGRAM_SUB_BUCKETS per power of two, i.e. within ~6% of the value.
+ * Values of 2^HISTOGRAM_MAX_BITS ns (~18 min) and more share the last bucket.
+ */
+enum {
+    HISTOGRAM_SUB_BITS = 4,
+    HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS,
+    HISTOGRAM_MAX_BITS = 40,
+    HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS,
+    LATENCY_STAMPS = 256 ///< send times kept per channel, a message read that many sends late is not measured
+};
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+typedef enum {
+    LATENCY_MESSAGE = 0, ///< one-way, from channel_write to the end of the read
+    LATENCY_TRANSFER,    ///< transfer() from TRANSFER sent to ACK received
+    LATENCY_KINDS
+} LatencyKind;
+
+/** Send time of the k-th message of a channel, seq is k + 1 once ns is in place. */
+typedef struct {
+    uint64_t seq;
+    uint64_t ns;
+} SendStamp;
+
+/** Histograms of one process. */
+typedef struct {
+    Histogram kinds[LATENCY_KINDS];
+} Latency;
+
+void histogram_record(Histogram *histogram, uint64_t ns);
+
+void histogram_merge(Histogram *into, const Histogram *from);
+
+/** Upper bound of the bucket holding the p-th quantile, 0 < p <= 1. */
+uint64_t histogram_percentile(const Histogram *histogram, double p);
+
+/** Measure the processes forked after this. Must be called before latency_open. */
+void latency_enable(void);
+
+/** True once latency_open has mapped the histograms, callers skip taking the time otherwise. */
+bool latency_enabled(void);
+
+/**
+ * A no-op unless enabled. Map one Latency per process, shared across fork. Every process records
+ * into the slot of current_id only, so no locking is needed and the parent
+ * reads all of them after wait(). Send times travel beside the messages in
+ * a ring of SendStamps per channel, so frames stay header and payload only.
+ */
+int latency_open(local_id n);
+
+void latency_record(LatencyKind kind, uint64_t ns);
+
+/** Sender: stamp the next message from current_id to dst with its send time. */
+void latency_sent(local_id dst, uint64_t ns);
+
+/** Receiver: record LATENCY_MESSAGE of the next message from src, read at ns. */
+void latency_received(local_id src, uint64_t ns);
+
+/** p50/p99/p999 of every process and merged over all of them, one line each. */
+void latency_print(FILE *fd);
+
+void latency_close(void);
+
+#endif //PROGRAM_LATENCY_H
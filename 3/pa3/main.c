@@ -9,7 +9,15 @@
 #include "banking.h"
 #include "common.h"
 #include "process.h"
+#include "collective.h"
 #include "pa2345.h"
+#include "snapshot.h"
+#include "history.h"
+#include "balance.h"
+#include "wal.h"
+#include "latency.h"
+#include "trace.h"
+#include "msgtrace.h"
 
 FILE *pipes_log_fd;
 FILE *event_log_fd;
@@ -19,18 +27,67 @@ timestamp_t local_time = 0;
 typedef struct {
     bool valid;
     local_id n;
+    int snapshot_period;
+    bool wal;
+    bool recover;
+    bool trace;
+    bool msg_trace;
+    bool latency;
     balance_t s[MAX_PROCESS_ID + 1];
 } Arguments;
 
+/**
+ * A history takes HISTORY_PARTS gathers of as many states as fit into a
+ * message in the worst case. Only a wide history needs more than one.
+ */
+enum {
+    HISTORY_PART_STATES = (GATHER_MAX_ITEM_LEN - BALANCE_HISTORY_HEADER_SIZE) / BALANCE_STATE_MAX_ENCODED_SIZE,
+    HISTORY_PARTS = (MAX_T + HISTORY_PART_STATES) / HISTORY_PART_STATES
+};
+
+static struct {
+    int period;
+    int transfers_count;
+    uint8_t taken;
+    int reports_count;
+    AllHistory history;
+} snapshots = {0};
+
+static struct {
+    bool enabled;
+    bool recover;
+    long transfers_applied; ///< by the destinations in the logged runs, bank_robbery skips them
+    long transfers_skipped;
+} wal_options = {0};
+
 Arguments parse_arguments(int argc, char *argv[]) {
     Arguments args = (Arguments) {.valid = true};
 
     int opt;
-    while ((opt = getopt(argc, argv, "p:")) != -1) {
+    while ((opt = getopt(argc, argv, "p:s:wrtML")) != -1) {
         switch (opt) {
             case 'p':
                 args.n = atoi(optarg);
                 break;
+            case 's':
+                args.snapshot_period = atoi(optarg);
+                break;
+            case 'w':
+                args.wal = true;
+                break;
+            case 'r':
+                args.wal = true;
+                args.recover = true;
+                break;
+            case 't':
+                args.trace = true;
+                break;
+            case 'M':
+                args.msg_trace = true;
+                break;
+            case 'L':
+                args.latency = true;
+                break;
             default:
                 fprintf(stderr, "Unknown option %c\n", opt);
                 args.valid = false;
@@ -47,18 +104,27 @@ Arguments parse_arguments(int argc, char *argv[]) {
 
 
     for (int i = optind; i < argc; i++) {
-        args.s[i - optind] = atoi(argv[i]);
+        args.s[i - optind] = (balance_t) strtoll(argv[i], NULL, 10);
     }
 
     return args;
 }
 
+static void parent_store_snapshot(local_id from, const Message *msg) {
+    snapshot_store_report(&snapshots.history, from, msg);
+    snapshots.reports_count++;
+}
+
 void transfer(void *parent_data, local_id src, local_id dst, balance_t amount) {
     Process* process = parent_data;
     if (src < 0 || src >= process->channels_size || dst < 0 || dst >= process->channels_size) {
         fprintf(stderr, "Incorrect transfer ids: src: %d, dst: %d", src, dst);
         exit(EXIT_FAILURE);
     }
+    if (wal_options.transfers_skipped < wal_options.transfers_applied) {
+        wal_options.transfers_skipped++;
+        return;
+    }
 
     TransferOrder order = (TransferOrder) {
         .s_amount = amount,
@@ -72,25 +138,40 @@ void transfer(void *parent_data, local_id src, local_id dst, balance_t amount) {
             .s_magic = MESSAGE_MAGIC,
             .s_type = TRANSFER,
             .s_local_time = get_lamport_time(),
-            .s_payload_len = sizeof(TransferOrder)
         },
     };
+    message.s_header.s_payload_len = transfer_order_encode(message.s_payload, &order);
 
-    memcpy(&message.s_payload, &order, sizeof(TransferOrder));
-
+    uint64_t start_ns = monotonic_ns();
     if (send(process, src, &message) != 0) {
         fprintf(stderr, "Failed to send message to id: %d", src);
         exit(EXIT_FAILURE);
     }
 
-    if (receive(process, dst, &message) != 0) {
-        fprintf(stderr, "Failed to receive message from id: %d", dst);
-        exit(EXIT_FAILURE);
-    }
+    do {
+        if (receive(process, dst, &message) != 0) {
+            fprintf(stderr, "Failed to receive message from id: %d", dst);
+            exit(EXIT_FAILURE);
+        }
+        if (message.s_header.s_type == SNAPSHOT_REPORT) {
+            parent_store_snapshot(dst, &message);
+        }
+    } while (message.s_header.s_type == SNAPSHOT_REPORT);
     if (message.s_header.s_type != ACK) {
         fprintf(stderr, "Wrong message type: %d", message.s_header.s_type);
         exit(EXIT_FAILURE);
     }
+    latency_record(LATENCY_TRANSFER, monotonic_ns() - start_ns);
+    trace_span(TRACE_TRANSFER, src, dst, start_ns);
+
+    snapshots.transfers_count++;
+    if (snapshots.period > 0 && snapshots.transfers_count % snapshots.period == 0 && snapshots.taken < MAX_SNAPSHOTS) {
+        if (snapshot_start(process, snapshots.taken) != 0) {
+            fprintf(stderr, "Failed to start snapshot: %d", snapshots.taken);
+            exit(EXIT_FAILURE);
+        }
+        snapshots.taken++;
+    }
 }
 
 static int child_start(Process *self) {
@@ -101,9 +182,9 @@ static int child_start(Process *self) {
     // send started
     local_time++;
     time = get_lamport_time();
-    str_size = sprintf(str_buffer, log_started_fmt, time, self->id, getpid(), getppid(), self->balance);
-    printf(log_started_fmt, time, self->id, getpid(), getppid(), self->balance);
-    fprintf(event_log_fd, log_started_fmt, time, self->id, getpid(), getppid(), self->balance);
+    str_size = sprintf(str_buffer, balance_log_started_fmt, time, self->id, getpid(), getppid(), self->balance);
+    printf(balance_log_started_fmt, time, self->id, getpid(), getppid(), self->balance);
+    fprintf(event_log_fd, balance_log_started_fmt, time, self->id, getpid(), getppid(), self->balance);
     fflush(event_log_fd);
 
     Message start_message = (Message) {
@@ -115,78 +196,245 @@ static int child_start(Process *self) {
             }
     };
     memcpy(start_message.s_payload, str_buffer, str_size);
-    if (send_multicast(self, &start_message) != 0) {
-        perror("Child multicast");
+
+    // wait all started
+    Barrier started;
+    barrier_init(&started, STARTED);
+    if (barrier_wait(self, &started, &start_message) != 0) {
+        perror("Child barrier");
         return -1;
     }
+    time = get_lamport_time();
+    printf(log_received_all_started_fmt, time, self->id);
+    fprintf(event_log_fd, log_received_all_started_fmt, time, self->id);
+    fflush(event_log_fd);
+    return 0;
+}
 
-    // wait all started
-    for (local_id i = 1; i < self->channels_size; i++) {
-        if (i == self->id) {
+/** s_history_len is a uint8_t, so the last time that fits is MAX_T - 1. */
+static int history_check_time(Process *self, timestamp_t time) {
+    if (time < 0 || time >= MAX_T) {
+        fprintf(stderr, "Process %d: time %d is out of the history range [0;%d)\n", self->id, time, MAX_T);
+        return -1;
+    }
+    return 0;
+}
+
+static int history_record(Process *self, timestamp_t time) {
+    if (history_check_time(self, time) != 0) {
+        return -1;
+    }
+    BalanceHistory *history = &self->history;
+    history->s_history[time] = (BalanceState) {
+            .s_balance = self->balance,
+            .s_time = time,
+            .s_balance_pending_in = self->pending
+    };
+    history->s_history_len = MAX(history->s_history_len, time + 1);
+    return 0;
+}
+
+static int history_settle(Process *self, timestamp_t time, balance_t amount) {
+    if (history_check_time(self, time) != 0) {
+        return -1;
+    }
+    BalanceHistory *history = &self->history;
+    if (history->s_history[time].s_time == -1) {
+        timestamp_t prev = time;
+        while (history->s_history[prev].s_time == -1) {
+            prev--;
+        }
+        history->s_history[time] = history->s_history[prev];
+        history->s_history[time].s_time = time;
+    }
+    history->s_history_len = MAX(history->s_history_len, time + 1);
+    for (size_t t = time; t < history->s_history_len; t++) {
+        BalanceState *state = &history->s_history[t];
+        if (state->s_time != -1) {
+            state->s_balance_pending_in -= amount;
+        }
+    }
+    return 0;
+}
+
+static int apply_transfer_out(Process *self, timestamp_t time, local_id dst, balance_t amount) {
+    if (self->outgoing_len == MAX_OUTGOING) {
+        fprintf(stderr, "Process %d: too many transfers in flight\n", self->id);
+        return -1;
+    }
+    if (__builtin_sub_overflow(self->balance, amount, &self->balance)) {
+        fprintf(stderr, "Balance overflow: process %d transferred out $%" PRId64 "\n", self->id, (int64_t) amount);
+        return -1;
+    }
+    self->pending += amount;
+    if (history_record(self, time) != 0) {
+        return -1;
+    }
+    self->outgoing[self->outgoing_len++] = (OutgoingTransfer) {
+            .dst = dst,
+            .amount = amount
+    };
+    return 0;
+}
+
+static int apply_transfer_in(Process *self, timestamp_t time, balance_t amount) {
+    if (__builtin_add_overflow(self->balance, amount, &self->balance)) {
+        fprintf(stderr, "Balance overflow: process %d received $%" PRId64 "\n", self->id, (int64_t) amount);
+        return -1;
+    }
+    return history_record(self, time);
+}
+
+/** Remove the oldest transfer to dst from the ones in flight, FIFO as the channel. */
+static int take_outgoing(Process *self, local_id dst, balance_t *amount) {
+    size_t i = 0;
+    while (i < self->outgoing_len && self->outgoing[i].dst != dst) {
+        i++;
+    }
+    if (i == self->outgoing_len) {
+        fprintf(stderr, "Process %d: no transfer to %d in flight\n", self->id, dst);
+        return -1;
+    }
+    *amount = self->outgoing[i].amount;
+    self->outgoing_len--;
+    memmove(&self->outgoing[i], &self->outgoing[i + 1], (self->outgoing_len - i) * sizeof(OutgoingTransfer));
+    self->pending -= *amount;
+    return 0;
+}
+
+static int apply_ack(Process *self, timestamp_t time, local_id dst, balance_t *amount) {
+    if (take_outgoing(self, dst, amount) != 0) {
+        return -1;
+    }
+    return history_settle(self, time, *amount);
+}
+
+static int apply_refund(Process *self, timestamp_t time, local_id dst, balance_t *amount) {
+    if (take_outgoing(self, dst, amount) != 0) {
+        return -1;
+    }
+    if (__builtin_add_overflow(self->balance, *amount, &self->balance)) {
+        fprintf(stderr, "Balance overflow: process %d took back $%" PRId64 "\n", self->id, (int64_t) *amount);
+        return -1;
+    }
+    if (history_settle(self, time, *amount) != 0) {
+        return -1;
+    }
+    return history_record(self, time);
+}
+
+/**
+ * Rebuild balance and transfers in flight from the log. The mesh and the
+ * Lamport clock of this run are new, so the recovered state is the state at
+ * time 0 of its history and the logged times are not carried over.
+ */
+static int child_replay_wal(Process *self) {
+    const WalHeader *header = self->wal.header;
+    if (header->s_checkpointed) {
+        self->balance = (balance_t) header->s_balance;
+        if (history_record(self, 0) != 0) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < header->s_len; i++) {
+        const WalRecord *record = &self->wal.records[i];
+        balance_t amount = record->s_amount;
+        int result;
+        switch (record->s_type) {
+            case WAL_TRANSFER_OUT:
+                result = apply_transfer_out(self, 0, record->s_peer, amount);
+                break;
+            case WAL_TRANSFER_IN:
+                result = apply_transfer_in(self, 0, amount);
+                break;
+            case WAL_ACK:
+                result = apply_ack(self, 0, record->s_peer, &amount);
+                break;
+            case WAL_REFUND:
+                result = apply_refund(self, 0, record->s_peer, &amount);
+                break;
+            default:
+                fprintf(stderr, "Process %d: corrupted WAL record %u\n", self->id, i);
+                return -1;
+        }
+        if (result != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Settle the transfers that were in flight when the previous run stopped.
+ * The pipes of that run are gone, so the log of the destination decides: it
+ * applies the transfers of a channel in order, the ones it logged are
+ * acknowledged and the rest are taken back.
+ */
+static int child_reconcile_wal(Process *self) {
+    for (local_id dst = 1; dst < self->channels_size; dst++) {
+        size_t unacked = 0;
+        for (size_t i = 0; i < self->outgoing_len; i++) {
+            unacked += self->outgoing[i].dst == dst;
+        }
+        if (unacked == 0) {
             continue;
         }
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("Child receive");
+        long applied = wal_count(dst, WAL_TRANSFER_IN, self->id);
+        long acked = wal_count(self->id, WAL_ACK, dst);
+        if (applied < 0 || acked < 0 || applied < acked || (size_t) (applied - acked) > unacked) {
+            fprintf(stderr, "Process %d: logs of transfers to %d don't match\n", self->id, dst);
             return -1;
         }
+        for (size_t i = 0; i < unacked; i++) {
+            bool is_applied = i < (size_t) (applied - acked);
+            WalRecordType type = is_applied ? WAL_ACK : WAL_REFUND;
+            balance_t amount;
+            int result = is_applied ? apply_ack(self, 0, dst, &amount) : apply_refund(self, 0, dst, &amount);
+            if (result != 0 || wal_append(&self->wal, type, dst, 0, amount) != 0) {
+                return -1;
+            }
+        }
     }
-    time = get_lamport_time();
-    printf(log_received_all_started_fmt, time, self->id);
-    fprintf(event_log_fd, log_received_all_started_fmt, time, self->id);
-    fflush(event_log_fd);
     return 0;
 }
 
+/** Once everything is settled the recovered balance is all the next recovery needs. */
+static int child_checkpoint_wal(Process *self) {
+    if (!wal_options.recover || self->outgoing_len != 0) {
+        return 0;
+    }
+    return wal_checkpoint(&self->wal, self->id, self->balance);
+}
+
 static int child_handle_transfer(Process *self, Message *message) {
-    TransferOrder *order = (TransferOrder *) message->s_payload;
+    TransferOrder decoded_order;
+    transfer_order_decode(message->s_payload, &decoded_order);
+    TransferOrder *order = &decoded_order;
     if (self->id == order->s_src) {
         local_time++;
         timestamp_t time = get_lamport_time();
-        printf(log_transfer_out_fmt, time, self->id, order->s_amount, order->s_dst);
-        fprintf(event_log_fd, log_transfer_out_fmt, time, self->id, order->s_amount, order->s_dst);
-        self->balance -= order->s_amount;
-
-        BalanceState state;
-        state = (BalanceState) {
-                .s_balance = self->balance,
-                .s_time = time,
-                .s_balance_pending_in = order->s_amount
-        };
-        self->history.s_history[time] = state;
-        self->history.s_history_len = time + 1;
-
-        message->s_header.s_local_time = time;
-        if (send(self, order->s_dst, message) != 0) {
+        printf(balance_log_transfer_out_fmt, time, self->id, order->s_amount, order->s_dst);
+        fprintf(event_log_fd, balance_log_transfer_out_fmt, time, self->id, order->s_amount, order->s_dst);
+        if (apply_transfer_out(self, time, order->s_dst, order->s_amount) != 0) {
             return -1;
         }
-        Message ack_message;
-        if (receive(self, order->s_dst, &ack_message) != 0 || ack_message.s_header.s_type != ACK) {
+        if (wal_append(&self->wal, WAL_TRANSFER_OUT, order->s_dst, time, order->s_amount) != 0) {
             return -1;
         }
-        time = ack_message.s_header.s_local_time - 1;
-        state = (BalanceState) {
-                .s_balance = self->balance,
-                .s_time = time,
-                .s_balance_pending_in = 0
-        };
-        self->history.s_history[time] = state;
-        self->history.s_history_len = time + 1;
 
-        return 0;
+        message->s_header.s_local_time = time;
+        return send(self, order->s_dst, message);
     } else if (self->id == order->s_dst) {
         timestamp_t time = get_lamport_time();
-        printf(log_transfer_in_fmt, time, self->id, order->s_amount, order->s_src);
-        fprintf(event_log_fd, log_transfer_in_fmt, time, self->id, order->s_amount, order->s_src);
-        self->balance += order->s_amount;
-
-        BalanceState state = (BalanceState) {
-                .s_balance = self->balance,
-                .s_time = time,
-                .s_balance_pending_in = 0
-        };
-        self->history.s_history[time] = state;
-        self->history.s_history_len = time + 1;
+        printf(balance_log_transfer_in_fmt, time, self->id, order->s_amount, order->s_src);
+        fprintf(event_log_fd, balance_log_transfer_in_fmt, time, self->id, order->s_amount, order->s_src);
+        if (apply_transfer_in(self, time, order->s_amount) != 0) {
+            return -1;
+        }
+        if (wal_append(&self->wal, WAL_TRANSFER_IN, order->s_src, time, order->s_amount) != 0) {
+            return -1;
+        }
+        snapshot_record_transfer(self, order);
 
         local_time++;
         Message ack_message = (Message) {
@@ -208,36 +456,71 @@ static int child_handle_transfer(Process *self, Message *message) {
     return -1;
 }
 
+static int child_handle_ack(Process *self, local_id from, Message *message) {
+    // destination received transfer right before sending ACK
+    timestamp_t time = message->s_header.s_local_time - 1;
+    balance_t amount;
+    if (apply_ack(self, time, from, &amount) != 0) {
+        return -1;
+    }
+    return wal_append(&self->wal, WAL_ACK, from, time, amount);
+}
+
+static int child_handle_message(Process *self, local_id from, Message *message) {
+    switch (message->s_header.s_type) {
+        case TRANSFER:
+            return child_handle_transfer(self, message);
+        case ACK:
+            return child_handle_ack(self, from, message);
+        case SNAPSHOT_MARKER:
+            return snapshot_handle_marker(self, from, message);
+        case STOP:
+            self->stopped = true;
+            return broadcast_forward(self, message);
+        case DONE:
+            return barrier_handle(self, &self->done, from, message);
+        default:
+            fprintf(stderr, "Unexpected message type: %d\n", message->s_header.s_type);
+            return -1;
+    }
+}
+
+static int child_receive_and_handle(Process *self) {
+    Message message;
+    local_id from = receive_any(self, &message);
+    if (from == -1) {
+        perror("Child receive_any");
+        return -1;
+    }
+    if (child_handle_message(self, from, &message) != 0) {
+        perror("Child handle message");
+        return -1;
+    }
+    return 0;
+}
+
+static void sum_balances(void *accumulator, const void *value) {
+    *(balance_t *) accumulator += *(const balance_t *) value;
+}
+
 static int child_work(Process *self) {
     char str_buffer[1024];
     timestamp_t time;
     size_t str_size;
 
-    // receive TRANSFER or STOP
-    Message message = (Message) {.s_header.s_type = TRANSFER};
-    while (message.s_header.s_type == TRANSFER) {
-        if (receive_any(self, &message) != 0) {
-            perror("Child receive_any");
+    // receive TRANSFER, ACK or STOP
+    while (!self->stopped) {
+        if (child_receive_and_handle(self) != 0) {
             return -1;
         }
-        if (message.s_header.s_type != TRANSFER && message.s_header.s_type != STOP) {
-            perror("Unexpected type");
-            return -1;
-        }
-        if (message.s_header.s_type == TRANSFER) {
-            if (child_handle_transfer(self, &message) != 0) {
-                perror("Child transfer");
-                return -1;
-            }
-        }
     }
 
     // send done
     local_time++;
     time = get_lamport_time();
-    str_size = sprintf(str_buffer, log_done_fmt, time, self->id, self->balance);
-    printf(log_done_fmt, time, self->id, self->balance);
-    fprintf(event_log_fd, log_done_fmt, time, self->id, self->balance);
+    str_size = sprintf(str_buffer, balance_log_done_fmt, time, self->id, self->balance);
+    printf(balance_log_done_fmt, time, self->id, self->balance);
+    fprintf(event_log_fd, balance_log_done_fmt, time, self->id, self->balance);
     fflush(event_log_fd);
 
     Message finish_message = (Message) {
@@ -249,33 +532,15 @@ static int child_work(Process *self) {
             }
     };
     memcpy(finish_message.s_payload, str_buffer, str_size);
-    if (send_multicast(self, &finish_message) != 0) {
-        perror("Child work multicast");
+    if (barrier_arrive(self, &self->done, &finish_message) != 0) {
+        perror("Child barrier");
         return -1;
     }
 
-    // receive TRANSFER and DONE
-    for (local_id id = 1; id < self->channels_size; id++) {
-        if (id == self->id) {
-            continue;
-        }
-        Message msg = (Message) {.s_header.s_type = TRANSFER};
-        while (msg.s_header.s_type == TRANSFER) {
-            if (receive(self, id, &msg) != 0) {
-                perror("Child receive: TRANSFER and DONE");
-                return -1;
-            }
-            if (msg.s_header.s_type == TRANSFER) {
-                if (child_handle_transfer(self, &msg) != 0) {
-                    perror("Child transfer");
-                    return -1;
-                }
-            } else if (msg.s_header.s_type == DONE) {
-                break;
-            } else {
-                fprintf(stderr, "Unexpected message type: %d", msg.s_header.s_type);
-                return -1;
-            }
+    // receive TRANSFER, ACK and DONE
+    while (!self->done.released || self->outgoing_len != 0) {
+        if (child_receive_and_handle(self) != 0) {
+            return -1;
         }
     }
 
@@ -285,118 +550,152 @@ static int child_work(Process *self) {
     fflush(event_log_fd);
 
     // send history
-    local_time++;
-    time = get_lamport_time();
-    BalanceHistory *history = &self->history;
-    size_t history_header_size = sizeof(history->s_id) + sizeof(history->s_history_len);
-    size_t history_payload_size = sizeof(history->s_history[0]) * history->s_history_len;
-    size_t history_size = history_header_size + history_payload_size;
-    Message history_message = (Message) {
-            .s_header = (MessageHeader) {
-                    .s_magic = MESSAGE_MAGIC,
-                    .s_payload_len = history_size,
-                    .s_type = BALANCE_HISTORY,
-                    .s_local_time = time
-            }
-    };
-    BalanceHistory* payload = (BalanceHistory *) history_message.s_payload;
-    *payload = *history;
-    if (send(self, PARENT_ID, &history_message) != 0) {
-        perror("Child send: BALANCE_HISTORY");
-        return -1;
+    for (size_t part = 0; part < HISTORY_PARTS; part++) {
+        char history[GATHER_MAX_ITEM_LEN];
+        size_t history_size = balance_history_encode(history, &self->history, part * HISTORY_PART_STATES,
+                                                     HISTORY_PART_STATES);
+        if (gather(self, BALANCE_HISTORY, history, history_size, NULL, NULL) != 0) {
+            perror("Child gather: BALANCE_HISTORY");
+            return -1;
+        }
     }
 
+    // the parent checks that no money was lost in flight
+    balance_t total = self->balance;
+    if (reduce(self, BALANCE_TOTAL, &total, sizeof(total), sum_balances) != 0) {
+        perror("Child reduce: BALANCE_TOTAL");
+        return -1;
+    }
     return 0;
 }
 
 static int child_run(Process *self) {
-    if (child_start(self) != 0) {
-        return -1;
+    if (wal_options.enabled) {
+        if (wal_open(&self->wal, self->id, wal_options.recover) != 0) {
+            return -1;
+        }
+        if (child_replay_wal(self) != 0 || child_reconcile_wal(self) != 0 || child_checkpoint_wal(self) != 0) {
+            wal_close(&self->wal, self->id);
+            return -1;
+        }
     }
-    if (child_work(self) != 0) {
-        return -1;
+    int result = 0;
+    if (child_start(self) != 0 || child_work(self) != 0) {
+        result = -1;
     }
-    return 0;
+    if (wal_close(&self->wal, self->id) != 0) {
+        result = -1;
+    }
+    return result;
 }
 
-static void continue_history(BalanceHistory* history, uint8_t max_t) {
-    BalanceState *state_ptr = &history->s_history[0];
-    for (uint8_t t = 1; t < max_t; t++) {
-        BalanceState *state = &history->s_history[t];
-        if (state->s_time == -1 || t >= history->s_history_len) {
-            *state = *state_ptr;
-            state->s_time = t;
+static void check_totals(const HistoryColumns *columns, balance_t final_total) {
+    for (size_t t = 1; t < columns->time_len; t++) {
+        if (columns->total[t] != columns->total[0]) {
+            fprintf(stderr, "Total balance changed at time %zu: %" PRId64 " -> %" PRId64 "\n",
+                    t, (int64_t) columns->total[0], (int64_t) columns->total[t]);
         }
-        state_ptr = state;
     }
-    history->s_history_len = max_t;
+    if (columns->time_len > 0 && final_total != columns->total[0]) {
+        fprintf(stderr, "Final balances sum to %" PRId64 ", expected %" PRId64 "\n",
+                (int64_t) final_total, (int64_t) columns->total[0]);
+    }
 }
 
-static void continue_all_history(AllHistory* all_history) {
-    uint8_t max_t = 0;
-    for (size_t i = 0; i < all_history->s_history_len; i++) {
-        BalanceHistory *history = &all_history->s_history[i];
-        max_t = MAX(max_t, history->s_history_len);
-    }
-    for (size_t i = 0; i < all_history->s_history_len; i++) {
-        BalanceHistory *history = &all_history->s_history[i];
-        continue_history(history, max_t);
-    }
+static void parent_store_history(local_id from, const char *payload, uint16_t len, void *arg) {
+    AllHistory *all_history = (AllHistory *) arg;
+    balance_history_decode(payload, &all_history->s_history[from - 1]);
 }
 
 static int parent_code(Process *self) {
-    timestamp_t time;
-
     // wait all started
-    for (local_id i = 1; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("Parent receive");
-            return -1;
+    Barrier started;
+    barrier_init(&started, STARTED);
+    if (barrier_wait(self, &started, NULL) != 0) {
+        perror("Parent barrier");
+        return -1;
+    }
+
+    // transfers go one at a time, every one the destinations logged is done
+    if (wal_options.recover) {
+        for (local_id id = 1; id < self->channels_size; id++) {
+            long count = wal_count(id, WAL_TRANSFER_IN, -1);
+            if (count < 0) {
+                return -1;
+            }
+            wal_options.transfers_applied += count;
         }
+        fprintf(stderr, "wal: %ld transfers were applied before, resuming after them\n",
+                wal_options.transfers_applied);
     }
 
+    snapshots.history.s_history_len = self->channels_size - 1;
     bank_robbery(self, self->channels_size - 1);
 
+    // wait all snapshots
+    while (snapshots.reports_count != snapshots.taken * (self->channels_size - 1)) {
+        Message msg;
+        local_id from = receive_any(self, &msg);
+        if (from == -1 || msg.s_header.s_type != SNAPSHOT_REPORT) {
+            perror("Parent receive: SNAPSHOT_REPORT");
+            return -1;
+        }
+        parent_store_snapshot(from, &msg);
+    }
+
     // send stop
-    local_time++;
-    time = get_lamport_time();
     Message message = (Message) {
         .s_header = (MessageHeader) {
             .s_magic = MESSAGE_MAGIC,
             .s_type = STOP,
-            .s_local_time = time,
             .s_payload_len = 0
         }
     };
-    if (send_multicast(self, &message) != 0) {
-        perror("Parent send multicast");
+    if (broadcast(self, &message) != 0) {
+        perror("Parent broadcast");
         return -1;
     }
 
     // wait all done
-    for (local_id i = 1; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != DONE) {
-            perror("Parent receive");
-            return -1;
-        }
+    if (barrier_wait(self, &self->done, NULL) != 0) {
+        perror("Parent barrier");
+        return -1;
     }
 
     // get all_history
     AllHistory all_history = (AllHistory) {.s_history_len = self->channels_size - 1};
-    for (local_id i = 1; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != BALANCE_HISTORY) {
-            perror("Parent receive: BALANCE_HISTORY");
+    for (size_t part = 0; part < HISTORY_PARTS; part++) {
+        if (gather(self, BALANCE_HISTORY, NULL, 0, parent_store_history, &all_history) != 0) {
+            perror("Parent gather: BALANCE_HISTORY");
             return -1;
         }
-        BalanceHistory* balance_history = (BalanceHistory *) msg.s_payload;
-        all_history.s_history[i - 1] = *balance_history;
+    }
+    balance_t total = 0;
+    if (reduce(self, BALANCE_TOTAL, &total, sizeof(total), sum_balances) != 0) {
+        perror("Parent reduce: BALANCE_TOTAL");
+        return -1;
     }
 
-    continue_all_history(&all_history);
+    HistoryColumns columns;
+    history_columns_load(&columns, &all_history);
+    history_columns_totals(&columns);
+    check_totals(&columns, total);
+#ifdef WIDE_BALANCE
+    history_columns_print(&columns);
+#else
+    history_columns_store(&columns, &all_history);
     print_history(&all_history);
+#endif
+    if (snapshots.taken > 0) {
+        printf("Snapshots taken every %d transfers, time is snapshot number:\n", snapshots.period);
+#ifdef WIDE_BALANCE
+        history_columns_load(&columns, &snapshots.history);
+        history_columns_totals(&columns);
+        history_columns_print(&columns);
+#else
+        print_history(&snapshots.history);
+#endif
+    }
     return 0;
 }
 
@@ -417,6 +716,18 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
     current_id = PARENT_ID;
+    snapshots.period = args.snapshot_period;
+    wal_options.enabled = args.wal;
+    wal_options.recover = args.recover;
+    if (args.trace && trace_open(trace_json) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (args.msg_trace) {
+        msgtrace_enable();
+    }
+    if (args.latency) {
+        latency_enable();
+    }
     if (run_processes(args.n + 1, parent_code, child_run, args.s) != 0) {
         fclose(pipes_log_fd);
         fclose(event_log_fd);
@@ -0,0 +1,91 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "msgtrace.h"
+#include "process.h"
+
+static const size_t msgtrace_size = MSGTRACE_HEADER_SIZE + sizeof(MsgTraceRecord) * MSGTRACE_CAPACITY;
+
+static struct {
+    bool enabled;
+    MsgTraceHeader *header;   ///< NULL while not mapped
+    MsgTraceRecord *records;
+} msgtrace;
+
+static uint64_t msgtrace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+void msgtrace_enable(void) {
+    msgtrace.enabled = true;
+}
+
+int msgtrace_open(local_id id) {
+    if (!msgtrace.enabled) {
+        return 0;
+    }
+    char path[32];
+    sprintf(path, msgtrace_file_fmt, id);
+    // truncating the ring of the previous run costs more than a new file
+    unlink(path);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1 || ftruncate(fd, msgtrace_size) != 0) {
+        perror("msgtrace open");
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    // a shared file mapping survives a crash of the process
+    void *map = mmap(NULL, msgtrace_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    msgtrace.header = map;
+    msgtrace.records = (MsgTraceRecord *) ((char *) map + MSGTRACE_HEADER_SIZE);
+    *msgtrace.header = (MsgTraceHeader) {
+            .magic = MSGTRACE_MAGIC,
+            .version = MSGTRACE_VERSION,
+            .process = id,
+            .capacity = MSGTRACE_CAPACITY,
+            .tsc_start = msgtrace_clock(),
+            .ns_start = monotonic_ns()
+    };
+    return 0;
+}
+
+void msgtrace_record(local_id src, local_id dst, const Message *msg) {
+    if (msgtrace.header == NULL) {
+        return;
+    }
+    MsgTraceRecord *record = &msgtrace.records[msgtrace.header->head++ & (MSGTRACE_CAPACITY - 1)];
+    record->tsc = msgtrace_clock();
+    record->lamport = msg->s_header.s_local_time;
+    record->payload_len = msg->s_header.s_payload_len;
+    record->type = msg->s_header.s_type;
+    record->src = src;
+    record->dst = dst;
+    memcpy(record->payload, msg->s_payload, MIN(msg->s_header.s_payload_len, MSGTRACE_PAYLOAD_PREFIX));
+}
+
+void msgtrace_close(void) {
+    if (msgtrace.header == NULL) {
+        return;
+    }
+    msgtrace.header->tsc_end = msgtrace_clock();
+    msgtrace.header->ns_end = monotonic_ns();
+    munmap(msgtrace.header, msgtrace_size);
+    msgtrace.header = NULL;
+}
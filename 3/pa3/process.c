@@ -2,8 +2,11 @@
 // Created by Vyacheslav Lebedev on 16.09.2024.
 //
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <sys/wait.h>
 #include <stdio.h>
+#include <time.h>
 #include <sched.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,6 +18,9 @@
 
 #include "ipc.h"
 #include "process.h"
+#include "latency.h"
+#include "trace.h"
+#include "msgtrace.h"
 
 extern FILE *pipes_log_fd;
 extern FILE *event_log_fd;
@@ -32,24 +38,28 @@ typedef enum {
     READ_STATUS_ERROR
 } ReadStatus;
 
-static ReadStatus read_non_blocking(const int fd, char *buffer, const size_t buffer_size) {
+static ReadStatus read_non_blocking(Channel *const cnl, char *buffer, const size_t buffer_size) {
     if (buffer_size == 0) {
         return READ_STATUS_OK;
     }
     ssize_t bytes_read;
-    bytes_read = read(fd, buffer, buffer_size);
+    cnl->stats.reads++;
+    bytes_read = read(cnl->rfd, buffer, buffer_size);
     if (bytes_read == 0) {
         return READ_STATUS_CLOSED;
     } else if (bytes_read < 0) {
         if (errno == EAGAIN) {
+            cnl->stats.read_eagain++;
             return READ_STATUS_EMPTY;
         } else {
             return READ_STATUS_ERROR;
         }
     }
     size_t ptr = bytes_read;
-    while (bytes_read < buffer_size) {
-        bytes_read = read(fd, buffer + ptr, buffer_size - ptr);
+    while (ptr < buffer_size) {
+        cnl->stats.partial_reads++;
+        cnl->stats.reads++;
+        bytes_read = read(cnl->rfd, buffer + ptr, buffer_size - ptr);
         if (bytes_read <= 0) {
             return READ_STATUS_ERROR;
         }
@@ -58,50 +68,87 @@ static ReadStatus read_non_blocking(const int fd, char *buffer, const size_t buf
     return READ_STATUS_OK;
 }
 
-static int read_blocking(const int fd, char *buffer, const size_t size) {
+static int read_blocking(Channel *const cnl, char *buffer, const size_t size) {
     ReadStatus status;
-    do {
-        status = read_non_blocking(fd, buffer, size);
-    } while (status == READ_STATUS_EMPTY);
+    uint64_t blocked_since = 0;
+    while ((status = read_non_blocking(cnl, buffer, size)) == READ_STATUS_EMPTY) {
+        if (blocked_since == 0) {
+            blocked_since = monotonic_ns();
+        }
+    }
+    if (blocked_since != 0) {
+        cnl->stats.blocked_ns += monotonic_ns() - blocked_since;
+    }
     return status;
 }
 
-static int channel_read_blocking(const Channel *const cnl, Message *msg) {
-    if (read_blocking(cnl->rfd, (char *) &msg->s_header, sizeof(MessageHeader)) != 0) {
+static int read_body(Channel *const cnl, Message *msg) {
+    const size_t len = msg->s_header.s_payload_len;
+    if (read_blocking(cnl, msg->s_payload, len) != 0) {
+        return -1;
+    }
+    if (latency_enabled()) {
+        latency_received(cnl->peer, monotonic_ns());
+    }
+    cnl->stats.received_messages++;
+    cnl->stats.received_bytes += sizeof(MessageHeader) + len;
+    return 0;
+}
+
+static int channel_read_blocking(Channel *const cnl, Message *msg) {
+    if (read_blocking(cnl, (char *) &msg->s_header, sizeof(MessageHeader)) != 0) {
         perror("Read blocking header");
         return -1;
     }
-    if (read_blocking(cnl->rfd, msg->s_payload, msg->s_header.s_payload_len) != 0) {
+    if (read_body(cnl, msg) != 0) {
         perror("Read blocking body");
         return -1;
     }
     return 0;
 }
 
-static ReadStatus channel_read_non_blocking(const Channel *const cnl, Message *msg) {
+static ReadStatus channel_read_non_blocking(Channel *const cnl, Message *msg) {
     ReadStatus status;
-    status = read_non_blocking(cnl->rfd, (char *) &msg->s_header, sizeof(MessageHeader));
+    status = read_non_blocking(cnl, (char *) &msg->s_header, sizeof(MessageHeader));
     if (status != READ_STATUS_OK) {
         return status;
     }
-    if (read_blocking(cnl->rfd, msg->s_payload, msg->s_header.s_payload_len) != 0) {
+    if (read_body(cnl, msg) != 0) {
         return READ_STATUS_ERROR;
     }
     return READ_STATUS_OK;
 }
 
-static int channel_write(const Channel *const cnl, const Message *const msg) {
+/** A full pipe is waited out, the peer drains it on its next receive. */
+static int channel_write(Channel *const cnl, const Message *const msg) {
     const size_t buffer_size = sizeof(MessageHeader) + msg->s_header.s_payload_len;
-    const char *buffer = (char *) msg;
+    const char *buffer = (const char *) msg;
+    if (latency_enabled()) {
+        latency_sent(cnl->peer, monotonic_ns());
+    }
     size_t ptr = 0;
+    uint64_t blocked_since = 0;
     do {
+        cnl->stats.writes++;
         ssize_t written = write(cnl->wfd, buffer + ptr, buffer_size - ptr);
-        if (written == -1) {
+        if (written == -1 && errno == EAGAIN) {
+            cnl->stats.write_eagain++;
+            if (blocked_since == 0) {
+                blocked_since = monotonic_ns();
+            }
+            sched_yield();
+            continue;
+        } else if (written == -1) {
             perror("Write err");
             return -1;
         }
         ptr += written;
     } while (ptr != buffer_size);
+    if (blocked_since != 0) {
+        cnl->stats.blocked_ns += monotonic_ns() - blocked_since;
+    }
+    cnl->stats.sent_messages++;
+    cnl->stats.sent_bytes += buffer_size;
     return 0;
 }
 
@@ -112,10 +159,13 @@ int receive(void *self, local_id from, Message *msg) {
     }
     Channel *channel = &process->channels[from];
 
+    uint64_t start_ns = trace_enabled() ? monotonic_ns() : 0;
     if (channel_read_blocking(channel, msg) != 0) {
         fprintf(stderr, "Unable to read blocking from id: %d \n", from);
         return -1;
     }
+    trace_message(TRACE_RECEIVE, from, msg, start_ns);
+    msgtrace_record(from, process->id, msg);
 
     if (msg->s_header.s_magic != MESSAGE_MAGIC) {
         return -1;
@@ -130,19 +180,22 @@ int receive_any(void *self, Message *msg) {
     bool empty_exists = false;
     do {
         empty_exists = false;
-        for (int i = 0; i < process->channels_size; i++) {
-            if (i == process->id) {
+        for (local_id id = 0; id < process->channels_size; id++) {
+            if (id == process->id) {
                 continue;
             }
-            Channel *channel = &process->channels[i];
+            Channel *channel = &process->channels[id];
+            uint64_t start_ns = trace_enabled() ? monotonic_ns() : 0;
             status = channel_read_non_blocking(channel, msg);
             switch (status) {
                 case READ_STATUS_OK: {
+                    trace_message(TRACE_RECEIVE, id, msg, start_ns);
+                    msgtrace_record(id, process->id, msg);
                     local_time = MAX(local_time, msg->s_header.s_local_time) + 1;
-                    return 0;
+                    return id;
                 }
                 case READ_STATUS_ERROR: {
-                    return -1;
+                    return (local_id) -1;
                 }
                 case READ_STATUS_EMPTY: {
                     empty_exists = true;
@@ -155,7 +208,17 @@ int receive_any(void *self, Message *msg) {
         }
         sched_yield();
     } while (empty_exists);
-    return -1;
+    return (local_id) -1;
+}
+
+static int channel_send(Process *process, local_id dst, const Message *msg) {
+    uint64_t start_ns = trace_enabled() ? monotonic_ns() : 0;
+    msgtrace_record(process->id, dst, msg);
+    if (channel_write(&process->channels[dst], msg) != 0) {
+        return -1;
+    }
+    trace_message(TRACE_SEND, dst, msg, start_ns);
+    return 0;
 }
 
 int send(void *self, local_id dst, const Message *msg) {
@@ -171,7 +234,7 @@ int send(void *self, local_id dst, const Message *msg) {
         return -1;
     }
 
-    return channel_write(&process->channels[dst], msg);
+    return channel_send(process, dst, msg);
 }
 
 int send_multicast(void *self, const Message *msg) {
@@ -185,8 +248,7 @@ int send_multicast(void *self, const Message *msg) {
         if (process->id == dst) {
             continue;
         }
-        Channel *channel = &process->channels[dst];
-        if (channel_write(channel, msg) != 0) {
+        if (channel_send(process, dst, msg) != 0) {
             return -1;
         }
     }
@@ -252,6 +314,7 @@ static Channel *extract_channels(pipe_desc *pipes_matrix, size_t n, size_t x) {
         pipe_desc *write_pipe = matrix_get(pipes_matrix, n, x, i);
         pipe_desc *read_pipe = matrix_get(pipes_matrix, n, i, x);
         channels[i] = (Channel) {
+                .peer = (local_id) i,
                 .rfd = read_pipe->data[0],
                 .wfd = write_pipe->data[1]
         };
@@ -272,9 +335,21 @@ static Channel *extract_channels(pipe_desc *pipes_matrix, size_t n, size_t x) {
     return channels;
 }
 
+static void print_channel_stats(local_id peer, const ChannelStats *stats) {
+    fprintf(pipes_log_fd, "channel process=%d peer=%d sent_messages=%u sent_bytes=%lu received_messages=%u "
+                          "received_bytes=%lu reads=%u writes=%u read_eagain=%u write_eagain=%u partial_reads=%u "
+                          "blocked_us=%lu\n",
+            current_id, peer, stats->sent_messages, (unsigned long) stats->sent_bytes, stats->received_messages,
+            (unsigned long) stats->received_bytes, stats->reads, stats->writes, stats->read_eagain,
+            stats->write_eagain, stats->partial_reads, (unsigned long) (stats->blocked_ns / 1000));
+}
+
 static void free_channels(Channel *channels, local_id channels_size) {
     for (local_id i = 0; i < channels_size; i++) {
         Channel *channel = &channels[i];
+        if (i != current_id) {
+            print_channel_stats(i, &channel->stats);
+        }
         if (channel->rfd != -1) {
             fprintf(pipes_log_fd, "Closed rfd [%d: %d]\n", current_id, i);
             close(channel->rfd);
@@ -302,6 +377,9 @@ static int run_child_process(
 
     // child code
     current_id = id;
+    if (msgtrace_open(id) != 0) {
+        exit(EXIT_FAILURE);
+    }
     Channel *channels = extract_channels(matrix, n, id);
     free(matrix);
     if (channels == NULL) {
@@ -319,6 +397,7 @@ static int run_child_process(
                     .s_history_len = 0
             }
     };
+    barrier_init(&cps.done, DONE);
     for (size_t i = 0; i < MAX_T + 1; i++) {
         cps.history.s_history[i].s_time = -1;
     }
@@ -328,6 +407,8 @@ static int run_child_process(
     start_state->s_balance_pending_in = 0;
 
     child_handler(&cps);
+    trace_flush();
+    msgtrace_close();
 
     free_channels(channels, n);
     fclose(pipes_log_fd);
@@ -341,6 +422,9 @@ int run_processes(
         process_handler child_handler,
         balance_t balances[MAX_PROCESS_ID + 1]
 ) {
+    if (latency_open(n) != 0) {
+        return -1;
+    }
     pipe_desc *matrix = open_pipes(n);
     if (matrix == NULL) {
         perror("malloc");
@@ -368,15 +452,30 @@ int run_processes(
             .balance = 0,
             .history = {0}
     };
+    barrier_init(&parent_process.done, DONE);
 
+    if (msgtrace_open(PARENT_ID) != 0) {
+        free_channels(channels, n);
+        return -1;
+    }
     parent_handler(&parent_process);
+    msgtrace_close();
 
     free_channels(channels, n);
 
     while (wait(NULL) > 0);
+    trace_close();
+    latency_print(stderr);
+    latency_close();
     return 0;
 }
 
 timestamp_t get_lamport_time(void) {
     return local_time;
 }
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -5,12 +5,44 @@
 #ifndef PROGRAM_PROCESS_H
 #define PROGRAM_PROCESS_H
 
+#include <stdbool.h>
+
 #include "ipc.h"
 #include "banking.h"
+#include "barrier.h"
+#include "snapshot.h"
+#include "wal.h"
+
+enum {
+    MAX_OUTGOING = MAX_T + 1,
+    BALANCE_TOTAL = SNAPSHOT_REPORT + 1 ///< message with balance_t, reduced to the parent after DONE
+};
+
+/** TRANSFER sent by source and not yet acknowledged by destination */
+typedef struct {
+    local_id dst;
+    balance_t amount;
+} OutgoingTransfer;
 
+/** Transport counters of one peer, written to the pipes log by free_channels. */
 typedef struct {
+    uint32_t sent_messages;
+    uint64_t sent_bytes;
+    uint32_t received_messages;
+    uint64_t received_bytes;
+    uint32_t reads;         ///< read syscalls, empty polls included
+    uint32_t writes;        ///< write syscalls
+    uint32_t read_eagain;
+    uint32_t write_eagain;
+    uint32_t partial_reads; ///< read returned less than asked
+    uint64_t blocked_ns;    ///< spinning on EAGAIN inside a blocking read or write
+} ChannelStats;
+
+typedef struct {
+    local_id peer;
     int rfd;
     int wfd;
+    ChannelStats stats;
 } Channel;
 
 typedef struct {
@@ -18,7 +50,14 @@ typedef struct {
     local_id channels_size;
     Channel *channels;
     balance_t balance;
+    balance_t pending;
     BalanceHistory history;
+    OutgoingTransfer outgoing[MAX_OUTGOING];
+    size_t outgoing_len;
+    bool stopped;
+    Barrier done;
+    Wal wal;
+    Snapshot snapshots[MAX_SNAPSHOTS];
 } Process;
 
 typedef int (*process_handler)(Process *);
@@ -30,4 +69,6 @@ int run_processes(
         balance_t balances[MAX_PROCESS_ID + 1]
 );
 
+uint64_t monotonic_ns(void);
+
 #endif //PROGRAM_PROCESS_H
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "balance.h"
+#include "process.h"
+#include "snapshot.h"
+
+extern timestamp_t local_time;
+
+static int send_markers(Process *self, uint8_t snapshot_id) {
+    local_time++;
+    Message message = (Message) {
+            .s_header = (MessageHeader) {
+                    .s_magic = MESSAGE_MAGIC,
+                    .s_type = SNAPSHOT_MARKER,
+                    .s_local_time = get_lamport_time(),
+                    .s_payload_len = sizeof(SnapshotMarker)
+            }
+    };
+    SnapshotMarker marker = (SnapshotMarker) {.s_id = snapshot_id};
+    memcpy(message.s_payload, &marker, sizeof(SnapshotMarker));
+
+    for (local_id dst = 1; dst < self->channels_size; dst++) {
+        if (dst == self->id) {
+            continue;
+        }
+        if (send(self, dst, &message) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int send_report(Process *self, uint8_t snapshot_id) {
+    Snapshot *snapshot = &self->snapshots[snapshot_id];
+    snapshot->status = SNAPSHOT_REPORTED;
+
+    local_time++;
+    Message message = (Message) {
+            .s_header = (MessageHeader) {
+                    .s_magic = MESSAGE_MAGIC,
+                    .s_type = SNAPSHOT_REPORT,
+                    .s_local_time = get_lamport_time()
+            }
+    };
+    message.s_payload[0] = (char) snapshot_id;
+    message.s_header.s_payload_len = sizeof(uint8_t) + balance_state_encode(message.s_payload + sizeof(uint8_t),
+                                                                            &snapshot->state);
+    return send(self, PARENT_ID, &message);
+}
+
+int snapshot_start(void *ptr, uint8_t snapshot_id) {
+    return send_markers((Process *) ptr, snapshot_id);
+}
+
+int snapshot_handle_marker(void *ptr, local_id from, const Message *msg) {
+    Process *self = (Process *) ptr;
+    const SnapshotMarker *marker = (const SnapshotMarker *) msg->s_payload;
+    Snapshot *snapshot = &self->snapshots[marker->s_id];
+
+    if (snapshot->status == SNAPSHOT_REPORTED) {
+        return 0;
+    }
+    if (snapshot->status == SNAPSHOT_IDLE) {
+        snapshot->status = SNAPSHOT_RECORDING;
+        snapshot->state = (BalanceState) {
+                .s_balance = self->balance,
+                .s_time = get_lamport_time(),
+                .s_balance_pending_in = 0
+        };
+        if (send_markers(self, marker->s_id) != 0) {
+            return -1;
+        }
+    }
+    if (from != PARENT_ID && !snapshot->closed[from]) {
+        snapshot->closed[from] = true;
+        snapshot->markers_count++;
+    }
+    if (snapshot->markers_count == self->channels_size - 2) {
+        return send_report(self, marker->s_id);
+    }
+    return 0;
+}
+
+void snapshot_record_transfer(void *ptr, const TransferOrder *order) {
+    Process *self = (Process *) ptr;
+    for (size_t i = 0; i < MAX_SNAPSHOTS; i++) {
+        Snapshot *snapshot = &self->snapshots[i];
+        if (snapshot->status == SNAPSHOT_RECORDING && !snapshot->closed[order->s_src]) {
+            snapshot->state.s_balance_pending_in += order->s_amount;
+        }
+    }
+}
+
+void snapshot_store_report(AllHistory *history, local_id from, const Message *msg) {
+    SnapshotReport report = (SnapshotReport) {.s_id = (uint8_t) msg->s_payload[0]};
+    balance_state_decode(msg->s_payload + sizeof(uint8_t), &report.s_state);
+    BalanceHistory *balance_history = &history->s_history[from - 1];
+    BalanceState state = report.s_state;
+    state.s_time = report.s_id;
+    balance_history->s_id = from;
+    balance_history->s_history[report.s_id] = state;
+    if (balance_history->s_history_len < report.s_id + 1) {
+        balance_history->s_history_len = report.s_id + 1;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef PROGRAM_SNAPSHOT_H
+#define PROGRAM_SNAPSHOT_H
+
+#include <stdbool.h>
+
+#include "ipc.h"
+#include "banking.h"
+
+enum {
+    SNAPSHOT_MARKER = CS_RELEASE + 1, ///< message with SnapshotMarker
+    SNAPSHOT_REPORT                   ///< message with SnapshotReport
+};
+
+enum {
+    MAX_SNAPSHOTS = MAX_T
+};
+
+typedef enum {
+    SNAPSHOT_IDLE = 0,
+    SNAPSHOT_RECORDING,
+    SNAPSHOT_REPORTED
+} SnapshotStatus;
+
+/**
+ * Chandy-Lamport snapshot state of a single child. Local balance is recorded
+ * on the first marker, money of TRANSFER orders arriving on a child channel
+ * before that channel's marker is accumulated in s_balance_pending_in.
+ */
+typedef struct {
+    SnapshotStatus status;
+    local_id markers_count;
+    bool closed[MAX_PROCESS_ID + 1];
+    BalanceState state;
+} Snapshot;
+
+typedef struct {
+    uint8_t s_id;
+} __attribute__((packed)) SnapshotMarker;
+
+/** Sent as s_id followed by s_state in the encoding of balance_state_encode. */
+typedef struct {
+    uint8_t      s_id;
+    BalanceState s_state;
+} SnapshotReport;
+
+/** Parent: send markers of a new snapshot to every child. */
+int snapshot_start(void *self, uint8_t snapshot_id);
+
+/** Child: handle SNAPSHOT_MARKER received from process `from`. */
+int snapshot_handle_marker(void *self, local_id from, const Message *msg);
+
+/** Child: account TRANSFER order received from its source as in-flight money. */
+void snapshot_record_transfer(void *self, const TransferOrder *order);
+
+/** Parent: put SNAPSHOT_REPORT received from child `from` into history. */
+void snapshot_store_report(AllHistory *history, local_id from, const Message *msg);
+
+#endif //PROGRAM_SNAPSHOT_H
@@ -0,0 +1,181 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "snapshot.h"
+#include "trace.h"
+
+extern local_id current_id;
+
+static const char *const kind_names[] = {
+        [TRACE_SEND] = "send",
+        [TRACE_RECEIVE] = "receive",
+        [TRACE_TRANSFER] = "transfer"
+};
+
+static const char *const type_names[] = {
+        [STARTED] = "STARTED",
+        [DONE] = "DONE",
+        [ACK] = "ACK",
+        [STOP] = "STOP",
+        [TRANSFER] = "TRANSFER",
+        [BALANCE_HISTORY] = "BALANCE_HISTORY",
+        [CS_REQUEST] = "CS_REQUEST",
+        [CS_REPLY] = "CS_REPLY",
+        [CS_RELEASE] = "CS_RELEASE",
+        [SNAPSHOT_MARKER] = "SNAPSHOT_MARKER",
+        [SNAPSHOT_REPORT] = "SNAPSHOT_REPORT",
+        [BALANCE_TOTAL] = "BALANCE_TOTAL"
+};
+
+static struct {
+    int fd;
+    TraceEvent *events;
+    size_t len;
+    size_t dropped;
+    uint32_t sent[MAX_PROCESS_ID + 1];
+    uint32_t received[MAX_PROCESS_ID + 1];
+} trace = {.fd = -1};
+
+int trace_open(const char *path) {
+    trace.events = malloc(sizeof(TraceEvent) * TRACE_CAPACITY);
+    if (trace.events == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    trace.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (trace.fd == -1 || write(trace.fd, "[\n", 2) != 2) {
+        perror("trace open");
+        free(trace.events);
+        trace.events = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+bool trace_enabled(void) {
+    return trace.events != NULL;
+}
+
+static TraceEvent *trace_add(TraceKind kind) {
+    if (trace.events == NULL) {
+        return NULL;
+    }
+    if (trace.len == TRACE_CAPACITY) {
+        trace.dropped++;
+        return NULL;
+    }
+    TraceEvent *event = &trace.events[trace.len++];
+    *event = (TraceEvent) {
+            .kind = kind,
+            .from = current_id,
+            .to = current_id,
+            .lamport = get_lamport_time(),
+            .end_ns = monotonic_ns()
+    };
+    event->start_ns = event->end_ns;
+    return event;
+}
+
+void trace_message(TraceKind kind, local_id peer, const Message *msg, uint64_t start_ns) {
+    TraceEvent *event = trace_add(kind);
+    if (event == NULL) {
+        return;
+    }
+    if (kind == TRACE_SEND) {
+        event->to = peer;
+        event->seq = trace.sent[peer]++;
+    } else {
+        event->from = peer;
+        event->seq = trace.received[peer]++;
+    }
+    event->type = msg->s_header.s_type;
+    event->lamport = msg->s_header.s_local_time;
+    event->start_ns = start_ns;
+}
+
+void trace_span(TraceKind kind, local_id from, local_id to, uint64_t start_ns) {
+    TraceEvent *event = trace_add(kind);
+    if (event != NULL) {
+        event->from = from;
+        event->to = to;
+        event->start_ns = start_ns;
+    }
+}
+
+static void print_event(FILE *out, const TraceEvent *event) {
+    double ts = event->start_ns / 1000.0;
+    const char *name = kind_names[event->kind];
+    double dur = (event->end_ns - event->start_ns) / 1000.0;
+    if (event->kind != TRACE_SEND && event->kind != TRACE_RECEIVE) {
+        fprintf(out, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":0,"
+                     "\"args\":{\"src\":%d,\"dst\":%d,\"lamport\":%d}},\n",
+                name, ts, dur, current_id, event->from, event->to, event->lamport);
+        return;
+    }
+
+    const char *type = NULL;
+    if (event->type >= 0 && event->type < (int) (sizeof(type_names) / sizeof(type_names[0]))) {
+        type = type_names[event->type];
+    }
+    char type_buffer[16];
+    if (type == NULL) {
+        sprintf(type_buffer, "%d", event->type);
+        type = type_buffer;
+    }
+    local_id peer = event->kind == TRACE_SEND ? event->to : event->from;
+    fprintf(out, "{\"name\":\"%s %s\",\"cat\":\"message\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,"
+                 "\"tid\":0,\"args\":{\"peer\":%d,\"lamport\":%d,\"seq\":%u}},\n",
+            name, type, ts, dur, current_id, peer, event->lamport, event->seq);
+    // the channel and the FIFO position identify a message on both sides
+    unsigned long id = ((unsigned long) (event->from * (MAX_PROCESS_ID + 1) + event->to) << 32) | event->seq;
+    const char *flow = event->kind == TRACE_SEND ? "\"ph\":\"s\"" : "\"ph\":\"f\",\"bp\":\"e\"";
+    fprintf(out, "{\"name\":\"message\",\"cat\":\"message\",%s,\"id\":%lu,\"ts\":%.3f,\"pid\":%d,\"tid\":0},\n",
+            flow, id, ts, current_id);
+}
+
+static void trace_write(bool last) {
+    if (trace.events == NULL) {
+        return;
+    }
+    char *buffer = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&buffer, &size);
+    if (out == NULL) {
+        perror("open_memstream");
+        return;
+    }
+    for (size_t i = 0; i < trace.len; i++) {
+        print_event(out, &trace.events[i]);
+    }
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"process %d\","
+                 "\"dropped\":%zu}}%s\n",
+            current_id, current_id, trace.dropped, last ? "\n]" : ",");
+    fclose(out);
+
+    // a single append keeps processes from interleaving
+    for (size_t written = 0; written < size;) {
+        ssize_t result = write(trace.fd, buffer + written, size - written);
+        if (result == -1) {
+            perror("trace write");
+            break;
+        }
+        written += result;
+    }
+    free(buffer);
+    free(trace.events);
+    trace.events = NULL;
+    close(trace.fd);
+}
+
+void trace_flush(void) {
+    trace_write(false);
+}
+
+void trace_close(void) {
+    trace_write(true);
+}
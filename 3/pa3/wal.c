@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "wal.h"
+
+static const size_t wal_size = sizeof(WalHeader) + sizeof(WalRecord) * WAL_CAPACITY;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int wal_sync(Wal *wal) {
+    const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t) &wal->records[wal->synced_len];
+    uintptr_t end = (uintptr_t) &wal->records[wal->header->s_len];
+    if (wal->synced_len == 0) {
+        begin = (uintptr_t) wal->header;
+    }
+    begin -= begin % page_size;
+    if (msync((void *) begin, end - begin, MS_ASYNC) != 0) {
+        perror("msync");
+        return -1;
+    }
+    wal->synced_len = wal->header->s_len;
+    wal->syncs_count++;
+    return 0;
+}
+
+int wal_open(Wal *wal, local_id id, bool recover) {
+    char path[64];
+    sprintf(path, "wal_%d.log", id);
+    *wal = (Wal) {.enabled = false, .fd = -1};
+
+    int flags = recover ? O_RDWR | O_CREAT : O_RDWR | O_CREAT | O_TRUNC;
+    wal->fd = open(path, flags, 0644);
+    if (wal->fd == -1) {
+        perror("open wal");
+        return -1;
+    }
+    if (ftruncate(wal->fd, wal_size) != 0) {
+        perror("ftruncate wal");
+        close(wal->fd);
+        return -1;
+    }
+    void *data = mmap(NULL, wal_size, PROT_READ | PROT_WRITE, MAP_SHARED, wal->fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap wal");
+        close(wal->fd);
+        return -1;
+    }
+    wal->header = data;
+    wal->records = (WalRecord *) (wal->header + 1);
+    if (wal->header->s_magic != WAL_MAGIC) {
+        *wal->header = (WalHeader) {.s_magic = WAL_MAGIC, .s_len = 0};
+    }
+    wal->synced_len = wal->header->s_len;
+    wal->enabled = true;
+    return 0;
+}
+
+int wal_append(Wal *wal, WalRecordType type, local_id peer, timestamp_t time, balance_t amount) {
+    if (!wal->enabled) {
+        return 0;
+    }
+    uint64_t start = now_ns();
+    if (wal->header->s_len == WAL_CAPACITY) {
+        fprintf(stderr, "WAL is full\n");
+        return -1;
+    }
+    wal->records[wal->header->s_len] = (WalRecord) {
+            .s_type = type,
+            .s_peer = peer,
+            .s_time = time,
+            .s_amount = amount
+    };
+    // record must be in place before it becomes visible to replay
+    __atomic_store_n(&wal->header->s_len, wal->header->s_len + 1, __ATOMIC_RELEASE);
+
+    wal->appended_count++;
+
+    int result = 0;
+    if (wal->header->s_len - wal->synced_len >= WAL_GROUP_SIZE) {
+        result = wal_sync(wal);
+    }
+    wal->append_ns += now_ns() - start;
+    return result;
+}
+
+long wal_count(local_id id, WalRecordType type, local_id peer) {
+    char path[64];
+    sprintf(path, "wal_%d.log", id);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        perror("open wal");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < wal_size) {
+        close(fd);
+        return 0;
+    }
+    void *data = mmap(NULL, wal_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap wal");
+        return -1;
+    }
+    const WalHeader *header = data;
+    const WalRecord *records = (const WalRecord *) (header + 1);
+    long count = 0;
+    if (header->s_magic == WAL_MAGIC && (type == WAL_TRANSFER_IN || type == WAL_ACK)) {
+        const uint32_t *folded = type == WAL_TRANSFER_IN ? header->s_transfers_in : header->s_acks;
+        for (local_id i = 0; i <= MAX_PROCESS_ID; i++) {
+            if (peer == -1 || peer == i) {
+                count += folded[i];
+            }
+        }
+    }
+    if (header->s_magic == WAL_MAGIC) {
+        uint32_t len = MIN(__atomic_load_n(&header->s_len, __ATOMIC_ACQUIRE), (uint32_t) WAL_CAPACITY);
+        for (uint32_t i = 0; i < len; i++) {
+            if (records[i].s_type == type && (peer == -1 || records[i].s_peer == peer)) {
+                count++;
+            }
+        }
+    }
+    munmap(data, wal_size);
+    return count;
+}
+
+int wal_checkpoint(Wal *wal, local_id id, balance_t balance) {
+    if (!wal->enabled) {
+        return 0;
+    }
+    WalHeader header = *wal->header;
+    for (uint32_t i = 0; i < wal->header->s_len; i++) {
+        const WalRecord *record = &wal->records[i];
+        if (record->s_peer < 0 || record->s_peer > MAX_PROCESS_ID) {
+            fprintf(stderr, "Process %d: corrupted WAL record %u\n", id, i);
+            return -1;
+        }
+        if (record->s_type == WAL_TRANSFER_IN) {
+            header.s_transfers_in[record->s_peer]++;
+        } else if (record->s_type == WAL_ACK) {
+            header.s_acks[record->s_peer]++;
+        }
+    }
+    header.s_len = 0;
+    header.s_checkpointed = 1;
+    header.s_balance = balance;
+
+    char path[64];
+    char tmp_path[64];
+    sprintf(path, "wal_%d.log", id);
+    sprintf(tmp_path, "wal_%d.log.tmp", id);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("open wal");
+        return -1;
+    }
+    if (ftruncate(fd, wal_size) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || fsync(fd) != 0) {
+        perror("write wal checkpoint");
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp_path, path) != 0) {
+        perror("rename wal");
+        unlink(tmp_path);
+        return -1;
+    }
+
+    // map the new log, the statistics cover the whole run
+    Wal old = *wal;
+    munmap(wal->header, wal_size);
+    close(wal->fd);
+    if (wal_open(wal, id, true) != 0) {
+        return -1;
+    }
+    wal->appended_count = old.appended_count;
+    wal->syncs_count = old.syncs_count;
+    wal->append_ns = old.append_ns;
+    return 0;
+}
+
+int wal_close(Wal *wal, local_id id) {
+    if (!wal->enabled) {
+        return 0;
+    }
+    uint32_t len = wal->header->s_len;
+    int result = 0;
+    if (wal->synced_len != len) {
+        result = wal_sync(wal);
+    }
+    uint32_t count = wal->appended_count;
+    fprintf(stderr, "wal: process %d appended %u records with %u msyncs, %lu ns per record\n",
+            id, count, wal->syncs_count, count == 0 ? 0 : (unsigned long) (wal->append_ns / count));
+    munmap(wal->header, wal_size);
+    close(wal->fd);
+    wal->enabled = false;
+    return result;
+}
@@ -0,0 +1,80 @@
+#ifndef PROGRAM_WAL_H
+#define PROGRAM_WAL_H
+
+#include <stdbool.h>
+
+#include "ipc.h"
+#include "banking.h"
+
+enum {
+    WAL_MAGIC = 0x57414C32,
+    WAL_CAPACITY = 4 * (MAX_T + 1), ///< every record takes at least one Lamport tick
+    WAL_GROUP_SIZE = 16             ///< records per msync
+};
+
+typedef enum {
+    WAL_TRANSFER_OUT = 1,
+    WAL_TRANSFER_IN,
+    WAL_ACK,
+    WAL_REFUND     ///< TRANSFER_OUT the destination never applied, taken back on recovery
+} WalRecordType;
+
+typedef struct {
+    uint8_t     s_type;
+    local_id    s_peer;
+    timestamp_t s_time;
+    balance_t   s_amount;
+} __attribute__((packed)) WalRecord;
+
+/** A checkpoint folds the records before it into the balance and the counts wal_count reports. */
+typedef struct {
+    uint32_t s_magic;
+    uint32_t s_len;
+    uint32_t s_checkpointed;                     ///< s_balance replaces the initial balance
+    int64_t  s_balance;
+    uint32_t s_transfers_in[MAX_PROCESS_ID + 1]; ///< folded TRANSFER_IN records per source
+    uint32_t s_acks[MAX_PROCESS_ID + 1];         ///< folded ACK records per destination
+} WalHeader;
+
+/**
+ * Append-only log of applied TransferOrders and ACKs of one child, mapped
+ * from "wal_<id>.log". Records are visible to replay as soon as appended, i.e.
+ * survive a killed process; msync(MS_ASYNC) is issued once per group of
+ * WAL_GROUP_SIZE records.
+ */
+typedef struct {
+    bool enabled;
+    int fd;
+    WalHeader *header;
+    WalRecord *records;
+    uint32_t synced_len;
+    uint32_t appended_count;
+    uint32_t syncs_count;
+    uint64_t append_ns;
+} Wal;
+
+/** Map log of process with given id, truncate it unless recover is set. */
+int wal_open(Wal *wal, local_id id, bool recover);
+
+int wal_append(Wal *wal, WalRecordType type, local_id peer, timestamp_t time, balance_t amount);
+
+/**
+ * Count records of type with peer, or with any peer if it is -1, in the log
+ * of process id, which may be mapped by that process at the same time.
+ * Records folded into a checkpoint are counted too.
+ * @return count, 0 if there is no log, or -1 on error
+ */
+long wal_count(local_id id, WalRecordType type, local_id peer);
+
+/**
+ * Fold the records into a checkpoint of balance and start over with an empty
+ * log, so that repeated recoveries don't fill it up. Only valid with no
+ * transfers in flight. The new log replaces the old one by a rename, so a
+ * concurrent wal_count sees either of them.
+ */
+int wal_checkpoint(Wal *wal, local_id id, balance_t balance);
+
+/** Sync all appended records and print overhead statistics. */
+int wal_close(Wal *wal, local_id id);
+
+#endif //PROGRAM_WAL_H
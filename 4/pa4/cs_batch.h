@@ -0,0 +1,30 @@
+#ifndef PROGRAM_CS_BATCH_H
+#define PROGRAM_CS_BATCH_H
+
+#include "ipc.h"
+
+/**
+ * Several operations per acquisition of the CS, the same in pa4 and pa5.
+ * Each lab implements request_cs_for and cs_contended on top of its own mutex.
+ */
+
+/**
+ * Enter the CS for a batch of up to ops operations, returns how many of them
+ * may run before release_cs, at most MAX_CS_BATCH. A batch that isn't
+ * positive enters nothing and fails with EINVAL.
+ */
+int request_cs_for(const void *self, int ops);
+
+/**
+ * Handle what has already arrived while in the CS, returns 1 if another
+ * process waits for it, 0 if none does, -1 on error.
+ */
+int cs_contended(const void *self);
+
+/**
+ * The loop of child id in batches of up to batch lines per acquisition, a
+ * batch ends early once another process waits for the CS.
+ */
+int child_work_batched(const void *self, local_id id, int batch);
+
+#endif //PROGRAM_CS_BATCH_H
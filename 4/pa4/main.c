@@ -10,6 +10,7 @@
 #include "common.h"
 #include "process.h"
 #include "pa2345.h"
+#include "latency.h"
 
 FILE *pipes_log_fd;
 FILE *event_log_fd;
@@ -20,9 +21,15 @@ static struct {
     bool valid;
     local_id n;
     bool use_mutex;
+    int batch;
+    int lock_timeout_ms;
+    bool latency;
 } arguments = {
         .valid = true,
         .use_mutex = false,
+        .batch = 1,
+        .lock_timeout_ms = 0,
+        .latency = false,
         .n = 0
 };
 
@@ -30,6 +37,9 @@ void parse_arguments(int argc, char *argv[]) {
     int opt;
     static struct option long_options[] = {
             {"mutexl", no_argument, 0, 'm' },
+            {"batch", required_argument, 0, 'b' },
+            {"lock-timeout", required_argument, 0, 't' },
+            {"latency", no_argument, 0, 'L' },
             {0, 0, 0, 0 }
     };
 
@@ -41,19 +51,54 @@ void parse_arguments(int argc, char *argv[]) {
             case 'm':
                 arguments.use_mutex = true;
                 break;
+            case 'b':
+                arguments.batch = atoi(optarg);
+                break;
+            case 't':
+                arguments.lock_timeout_ms = atoi(optarg);
+                break;
+            case 'L':
+                arguments.latency = true;
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-p N] [--mutex]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-p N] [--mutex] [--batch B] [--lock-timeout MS] [--latency]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
+    if (arguments.batch < 1) {
+        fprintf(stderr, "Batch must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Retry after every timeout with twice the timeout, so that a request
+ * eventually outwaits the ones ahead of it. The withdrawn requests are only
+ * counted.
+ */
+static int request_cs_retrying(Process *self, int *withdrawn) {
+    if (arguments.lock_timeout_ms <= 0) {
+        return request_cs(self);
+    }
+    uint64_t timeout_ns = arguments.lock_timeout_ms * 1000000ull;
+    int result;
+    while ((result = request_cs_timeout(self, timeout_ns)) == 1) {
+        (*withdrawn)++;
+        timeout_ns = timeout_ns > UINT64_MAX / 2 ? UINT64_MAX : timeout_ns * 2;
+    }
+    return result;
 }
 
 static int child_work(Process *self) {
+    if (arguments.use_mutex && arguments.batch > 1) {
+        return child_work_batched(self, self->id, arguments.batch);
+    }
     int n = self->id * 5;
+    int withdrawn = 0;
     char buffer[1024];
     for (int i = 1; i < n + 1; i++) {
         if (arguments.use_mutex) {
-            if (request_cs(self) != 0) {
+            if (request_cs_retrying(self, &withdrawn) != 0) {
                 perror("Child mutex request");
                 return -1;
             }
@@ -69,6 +114,9 @@ static int child_work(Process *self) {
             }
         }
     }
+    if (withdrawn > 0) {
+        fprintf(stderr, "process %d withdrew %d timed out CS requests\n", self->id, withdrawn);
+    }
     return 0;
 }
 
@@ -94,21 +142,13 @@ static int child_run(Process *self) {
             }
     };
     memcpy(start_message.s_payload, str_buffer, str_size);
-    if (send_multicast(self, &start_message) != 0) {
-        perror("Child multicast");
-        return -1;
-    }
 
     // wait all started
-    for (local_id i = FIRST_CHILD_ID; i < self->channels_size; i++) {
-        if (i == self->id) {
-            continue;
-        }
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("Child receive");
-            return -1;
-        }
+    Barrier started;
+    barrier_init(&started, STARTED);
+    if (barrier_wait(self, &started, &start_message) != 0) {
+        perror("Child barrier");
+        return -1;
     }
     time = get_lamport_time();
     printf(log_received_all_started_fmt, time, self->id);
@@ -137,35 +177,19 @@ static int child_run(Process *self) {
             }
     };
     memcpy(finish_message.s_payload, str_buffer, str_size);
-    if (send_multicast(self, &finish_message) != 0) {
-        perror("Child work multicast");
-        return -1;
-    }
-
-    while (self->done_count != self->channels_size - 2) {
-        Message msg;
-        local_id id = receive_any(self, &msg);
-        if (id == -1) {
+    if (!arguments.use_mutex) {
+        if (barrier_wait(self, &self->done, &finish_message) != 0) {
+            perror("Child barrier");
             return -1;
         }
-        if (arguments.use_mutex) {
-            if (msg.s_header.s_type == CS_REQUEST) {
-                queue_put(&self->queue, id, msg.s_header.s_local_time);
-                local_time++;
-                if (send_cs(self, id, CS_REPLY) != 0) {
-                    return -1;
-                }
-            } else if (msg.s_header.s_type == CS_RELEASE) {
-                queue_pop(&self->queue, id);
-            } else if (msg.s_header.s_type == DONE) {
-                self->done_count++;
-            } else {
-                return -1;
-            }
-        } else {
-             if (msg.s_header.s_type == DONE) {
-                 self->done_count++;
-            } else {
+    } else {
+        if (barrier_arrive(self, &self->done, &finish_message) != 0) {
+            perror("Child barrier");
+            return -1;
+        }
+        // peers still in the CS protocol need answers until the barrier is released
+        while (!self->done.released) {
+            if (cs_receive_and_handle(self) != 0) {
                 return -1;
             }
         }
@@ -180,21 +204,17 @@ static int child_run(Process *self) {
 
 static int parent_run(Process *self) {
     // wait all started
-    for (local_id i = FIRST_CHILD_ID; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("Parent receive");
-            return -1;
-        }
+    Barrier started;
+    barrier_init(&started, STARTED);
+    if (barrier_wait(self, &started, NULL) != 0) {
+        perror("Parent barrier");
+        return -1;
     }
 
     // wait all done
-    for (local_id i = FIRST_CHILD_ID; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != DONE) {
-            perror("Parent receive");
-            return -1;
-        }
+    if (barrier_wait(self, &self->done, NULL) != 0) {
+        perror("Parent barrier");
+        return -1;
     }
     return 0;
 }
@@ -216,6 +236,9 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
     current_id = PARENT_ID;
+    if (arguments.latency) {
+        latency_enable();
+    }
     if (run_processes(arguments.n + 1, parent_run, child_run) != 0) {
         fclose(pipes_log_fd);
         fclose(event_log_fd);
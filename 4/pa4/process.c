@@ -2,8 +2,11 @@
 // Created by Vyacheslav Lebedev on 16.09.2024.
 //
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <sys/wait.h>
 #include <stdio.h>
+#include <time.h>
 #include <sched.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,6 +18,7 @@
 
 #include "ipc.h"
 #include "process.h"
+#include "latency.h"
 
 extern FILE *pipes_log_fd;
 extern FILE *event_log_fd;
@@ -32,24 +36,28 @@ typedef enum {
     READ_STATUS_ERROR
 } ReadStatus;
 
-static ReadStatus read_non_blocking(const int fd, char *buffer, const size_t buffer_size) {
+static ReadStatus read_non_blocking(Channel *const cnl, char *buffer, const size_t buffer_size) {
     if (buffer_size == 0) {
         return READ_STATUS_OK;
     }
     ssize_t bytes_read;
-    bytes_read = read(fd, buffer, buffer_size);
+    cnl->stats.reads++;
+    bytes_read = read(cnl->rfd, buffer, buffer_size);
     if (bytes_read == 0) {
         return READ_STATUS_CLOSED;
     } else if (bytes_read < 0) {
         if (errno == EAGAIN) {
+            cnl->stats.read_eagain++;
             return READ_STATUS_EMPTY;
         } else {
             return READ_STATUS_ERROR;
         }
     }
     size_t ptr = bytes_read;
-    while (bytes_read < buffer_size) {
-        bytes_read = read(fd, buffer + ptr, buffer_size - ptr);
+    while (ptr < buffer_size) {
+        cnl->stats.partial_reads++;
+        cnl->stats.reads++;
+        bytes_read = read(cnl->rfd, buffer + ptr, buffer_size - ptr);
         if (bytes_read <= 0) {
             return READ_STATUS_ERROR;
         }
@@ -58,50 +66,87 @@ static ReadStatus read_non_blocking(const int fd, char *buffer, const size_t buf
     return READ_STATUS_OK;
 }
 
-static int read_blocking(const int fd, char *buffer, const size_t size) {
+static int read_blocking(Channel *const cnl, char *buffer, const size_t size) {
     ReadStatus status;
-    do {
-        status = read_non_blocking(fd, buffer, size);
-    } while (status == READ_STATUS_EMPTY);
+    uint64_t blocked_since = 0;
+    while ((status = read_non_blocking(cnl, buffer, size)) == READ_STATUS_EMPTY) {
+        if (blocked_since == 0) {
+            blocked_since = monotonic_ns();
+        }
+    }
+    if (blocked_since != 0) {
+        cnl->stats.blocked_ns += monotonic_ns() - blocked_since;
+    }
     return status;
 }
 
-static int channel_read_blocking(const Channel *const cnl, Message *msg) {
-    if (read_blocking(cnl->rfd, (char *) &msg->s_header, sizeof(MessageHeader)) != 0) {
+static int read_body(Channel *const cnl, Message *msg) {
+    const size_t len = msg->s_header.s_payload_len;
+    if (read_blocking(cnl, msg->s_payload, len) != 0) {
+        return -1;
+    }
+    if (latency_enabled()) {
+        latency_received(cnl->peer, monotonic_ns());
+    }
+    cnl->stats.received_messages++;
+    cnl->stats.received_bytes += sizeof(MessageHeader) + len;
+    return 0;
+}
+
+static int channel_read_blocking(Channel *const cnl, Message *msg) {
+    if (read_blocking(cnl, (char *) &msg->s_header, sizeof(MessageHeader)) != 0) {
         perror("Read blocking header");
         return -1;
     }
-    if (read_blocking(cnl->rfd, msg->s_payload, msg->s_header.s_payload_len) != 0) {
+    if (read_body(cnl, msg) != 0) {
         perror("Read blocking body");
         return -1;
     }
     return 0;
 }
 
-static ReadStatus channel_read_non_blocking(const Channel *const cnl, Message *msg) {
+static ReadStatus channel_read_non_blocking(Channel *const cnl, Message *msg) {
     ReadStatus status;
-    status = read_non_blocking(cnl->rfd, (char *) &msg->s_header, sizeof(MessageHeader));
+    status = read_non_blocking(cnl, (char *) &msg->s_header, sizeof(MessageHeader));
     if (status != READ_STATUS_OK) {
         return status;
     }
-    if (read_blocking(cnl->rfd, msg->s_payload, msg->s_header.s_payload_len) != 0) {
+    if (read_body(cnl, msg) != 0) {
         return READ_STATUS_ERROR;
     }
     return READ_STATUS_OK;
 }
 
-static int channel_write(const Channel *const cnl, const Message *const msg) {
+/** A full pipe is waited out, the peer drains it on its next receive. */
+static int channel_write(Channel *const cnl, const Message *const msg) {
     const size_t buffer_size = sizeof(MessageHeader) + msg->s_header.s_payload_len;
-    const char *buffer = (char *) msg;
+    const char *buffer = (const char *) msg;
+    if (latency_enabled()) {
+        latency_sent(cnl->peer, monotonic_ns());
+    }
     size_t ptr = 0;
+    uint64_t blocked_since = 0;
     do {
+        cnl->stats.writes++;
         ssize_t written = write(cnl->wfd, buffer + ptr, buffer_size - ptr);
-        if (written == -1) {
+        if (written == -1 && errno == EAGAIN) {
+            cnl->stats.write_eagain++;
+            if (blocked_since == 0) {
+                blocked_since = monotonic_ns();
+            }
+            sched_yield();
+            continue;
+        } else if (written == -1) {
             perror("Write err");
             return -1;
         }
         ptr += written;
     } while (ptr != buffer_size);
+    if (blocked_since != 0) {
+        cnl->stats.blocked_ns += monotonic_ns() - blocked_since;
+    }
+    cnl->stats.sent_messages++;
+    cnl->stats.sent_bytes += buffer_size;
     return 0;
 }
 
@@ -124,38 +169,43 @@ int receive(void *self, local_id from, Message *msg) {
     return 0;
 }
 
-int receive_any(void *self, Message *msg) {
-    Process *process = (Process *) self;
-    ReadStatus status;
+/** One pass over all channels, READ_STATUS_CLOSED means every channel is closed. */
+static ReadStatus receive_any_non_blocking(Process *process, Message *msg, local_id *from) {
     bool empty_exists = false;
-    do {
-        empty_exists = false;
-        for (local_id id = 0; id < process->channels_size; id++) {
-            if (id == process->id) {
-                continue;
+    for (local_id id = 0; id < process->channels_size; id++) {
+        if (id == process->id) {
+            continue;
+        }
+        Channel *channel = &process->channels[id];
+        switch (channel_read_non_blocking(channel, msg)) {
+            case READ_STATUS_OK: {
+                local_time = MAX(local_time, msg->s_header.s_local_time) + 1;
+                *from = id;
+                return READ_STATUS_OK;
             }
-            Channel *channel = &process->channels[id];
-            status = channel_read_non_blocking(channel, msg);
-            switch (status) {
-                case READ_STATUS_OK: {
-                    local_time = MAX(local_time, msg->s_header.s_local_time) + 1;
-                    return id;
-                }
-                case READ_STATUS_ERROR: {
-                    return (local_id) -1;
-                }
-                case READ_STATUS_EMPTY: {
-                    empty_exists = true;
-                    break;
-                }
-                case READ_STATUS_CLOSED: {
-                    continue;
-                }
+            case READ_STATUS_ERROR: {
+                return READ_STATUS_ERROR;
+            }
+            case READ_STATUS_EMPTY: {
+                empty_exists = true;
+                break;
+            }
+            case READ_STATUS_CLOSED: {
+                continue;
             }
         }
+    }
+    return empty_exists ? READ_STATUS_EMPTY : READ_STATUS_CLOSED;
+}
+
+int receive_any(void *self, Message *msg) {
+    Process *process = (Process *) self;
+    ReadStatus status;
+    local_id from;
+    while ((status = receive_any_non_blocking(process, msg, &from)) == READ_STATUS_EMPTY) {
         sched_yield();
-    } while (empty_exists);
-    return (local_id) -1;
+    }
+    return status == READ_STATUS_OK ? from : (local_id) -1;
 }
 
 int send(void *self, local_id dst, const Message *msg) {
@@ -252,6 +302,7 @@ static Channel *extract_channels(pipe_desc *pipes_matrix, size_t n, size_t x) {
         pipe_desc *write_pipe = matrix_get(pipes_matrix, n, x, i);
         pipe_desc *read_pipe = matrix_get(pipes_matrix, n, i, x);
         channels[i] = (Channel) {
+                .peer = (local_id) i,
                 .rfd = read_pipe->data[0],
                 .wfd = write_pipe->data[1]
         };
@@ -272,9 +323,21 @@ static Channel *extract_channels(pipe_desc *pipes_matrix, size_t n, size_t x) {
     return channels;
 }
 
+static void print_channel_stats(local_id peer, const ChannelStats *stats) {
+    fprintf(pipes_log_fd, "channel process=%d peer=%d sent_messages=%u sent_bytes=%lu received_messages=%u "
+                          "received_bytes=%lu reads=%u writes=%u read_eagain=%u write_eagain=%u partial_reads=%u "
+                          "blocked_us=%lu\n",
+            current_id, peer, stats->sent_messages, (unsigned long) stats->sent_bytes, stats->received_messages,
+            (unsigned long) stats->received_bytes, stats->reads, stats->writes, stats->read_eagain,
+            stats->write_eagain, stats->partial_reads, (unsigned long) (stats->blocked_ns / 1000));
+}
+
 static void free_channels(Channel *channels, local_id channels_size) {
     for (local_id i = 0; i < channels_size; i++) {
         Channel *channel = &channels[i];
+        if (i != current_id) {
+            print_channel_stats(i, &channel->stats);
+        }
         if (channel->rfd != -1) {
             fprintf(pipes_log_fd, "Closed rfd [%d: %d]\n", current_id, i);
             close(channel->rfd);
@@ -310,17 +373,19 @@ static int run_child_process(local_id id, local_id n, pipe_desc *matrix, process
     Process cps = (Process) {
             .channels = channels,
             .channels_size = n,
-            .id = id,
-            .done_count = 0
+            .id = id
     };
-    for (int i = 0; i < QUEUE_MAX_SIZE; i++) {
-        cps.queue.requests[i] = QUEUE_EMPTY_VALUE;
+    barrier_init(&cps.done, DONE);
+    if (queue_init(&cps.queue) != 0) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
     }
 
     if (child_handler(&cps) != 0) {
         printf("Child handler error \n");
     }
 
+    queue_free(&cps.queue);
     free_channels(channels, n);
     fclose(pipes_log_fd);
     fclose(event_log_fd);
@@ -328,6 +393,9 @@ static int run_child_process(local_id id, local_id n, pipe_desc *matrix, process
 }
 
 int run_processes(local_id n, process_handler parent_handler, process_handler child_handler) {
+    if (latency_open(n) != 0) {
+        return -1;
+    }
     pipe_desc *matrix = open_pipes(n);
     if (matrix == NULL) {
         perror("malloc");
@@ -353,12 +421,15 @@ int run_processes(local_id n, process_handler parent_handler, process_handler ch
             .channels = channels,
             .channels_size = n
     };
+    barrier_init(&parent_process.done, DONE);
 
     parent_handler(&parent_process);
 
     free_channels(channels, n);
 
     while (wait(NULL) > 0);
+    latency_print(stderr);
+    latency_close();
     return 0;
 }
 
@@ -366,46 +437,6 @@ timestamp_t get_lamport_time(void) {
     return local_time;
 }
 
-bool queue_empty(Queue *q) {
-    return q->size == 0;
-}
-
-local_id queue_min(Queue *q) {
-    if (queue_empty(q)) {
-        return INVALID_ID;
-    }
-    local_id min_id = 0;
-    for (local_id id = 0; id < QUEUE_MAX_SIZE; id++) {
-        if (q->requests[id] < q->requests[min_id]) {
-            min_id = id;
-        }
-    }
-    return min_id;
-}
-
-
-void queue_put(Queue *q, local_id id, timestamp_t t) {
-    if (id > MAX_PROCESS_ID || id < 0) {
-        fprintf(stderr, "id out of bounds");
-        exit(EXIT_FAILURE);
-    }
-
-    q->size++;
-    q->requests[id] = t;
-}
-
-timestamp_t queue_pop(Queue *q, local_id id) {
-    if (id > MAX_PROCESS_ID || id < 0) {
-        fprintf(stderr, "id out of bounds");
-        exit(EXIT_FAILURE);
-    }
-
-    q->size--;
-    timestamp_t value = q->requests[id];
-    q->requests[id] = QUEUE_EMPTY_VALUE;
-    return value;
-}
-
 int send_cs_multicast(Process* self, const MessageType type) {
     Message msg = (Message) {
             .s_header = (MessageHeader) {
@@ -440,43 +471,146 @@ int send_cs(Process* self, const local_id dst, const MessageType type) {
     return send(self, dst, &msg);
 }
 
-int request_cs(const void *ptr) {
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cs_handle(Process *self, local_id id, const Message *msg) {
+    if (msg->s_header.s_type == CS_REPLY) {
+        // replies to a withdrawn request come first, channels are FIFO
+        if (self->stale_replies[id] > 0) {
+            self->stale_replies[id]--;
+        } else {
+            self->replied[id] = true;
+        }
+    } else if (msg->s_header.s_type == DONE) {
+        return barrier_handle(self, &self->done, id, msg);
+    } else if (msg->s_header.s_type == CS_REQUEST) {
+        queue_put(&self->queue, id, msg->s_header.s_local_time);
+        local_time++;
+        if (send_cs(self, id, CS_REPLY) != 0) {
+            return -1;
+        }
+    } else if (msg->s_header.s_type == CS_RELEASE) {
+        queue_pop(&self->queue, id);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int cs_receive_and_handle(Process *self) {
+    Message msg;
+    local_id id = receive_any(self, &msg);
+    if (id == -1) {
+        return -1;
+    }
+    return cs_handle(self, id, &msg);
+}
+
+static bool cs_entered(Process *self) {
+    if (queue_min(&self->queue) != self->id) {
+        return false;
+    }
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        if (id != self->id && !self->replied[id]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Leave the queue everywhere, replies still on the way are dropped on arrival. */
+static int cs_withdraw(Process *self) {
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        if (id != self->id && !self->replied[id]) {
+            self->stale_replies[id]++;
+        }
+    }
+    queue_pop(&self->queue, self->id);
+    local_time++;
+    return send_cs_multicast(self, CS_RELEASE);
+}
+
+/** Saturates, UINT64_MAX is no deadline. */
+static uint64_t deadline_after(uint64_t timeout_ns) {
+    uint64_t now_ns = monotonic_ns();
+    return timeout_ns > UINT64_MAX - now_ns ? UINT64_MAX : now_ns + timeout_ns;
+}
+
+int request_cs_timeout(const void *ptr, uint64_t timeout_ns) {
     Process *self = (Process *) ptr;
+    uint64_t start_ns = monotonic_ns();
 
     local_time++;
     queue_put(&self->queue, self->id, get_lamport_time());
+    memset(self->replied, 0, sizeof(self->replied));
     if (send_cs_multicast(self, CS_REQUEST) != 0) {
         return -1;
     }
+    // sending to n - 1 peers doesn't eat into the wait
+    uint64_t deadline_ns = deadline_after(timeout_ns);
 
-    local_id reply_count = 0;
-    while (queue_min(&self->queue) != self->id || reply_count != self->channels_size - 2) {
+    while (!cs_entered(self)) {
         Message msg;
-        local_id id = receive_any(self, &msg);
-        if (id == -1) {
-            return -1;
-        }
-        fflush(stdout);
-        if (msg.s_header.s_type == CS_REPLY) {
-            reply_count++;
-        } else if (msg.s_header.s_type == DONE) {
-            self->done_count++;
-        } else if (msg.s_header.s_type == CS_REQUEST) {
-            queue_put(&self->queue, id, msg.s_header.s_local_time);
-            local_time++;
-            if (send_cs(self, id, CS_REPLY) != 0) {
+        local_id id;
+        ReadStatus status = receive_any_non_blocking(self, &msg, &id);
+        if (status == READ_STATUS_OK) {
+            fflush(stdout);
+            if (cs_handle(self, id, &msg) != 0) {
                 return -1;
             }
-        } else if (msg.s_header.s_type == CS_RELEASE) {
-            queue_pop(&self->queue, id);
-        } else {
+        } else if (status != READ_STATUS_EMPTY) {
             return -1;
+        } else if (monotonic_ns() >= deadline_ns) {
+            return cs_withdraw(self) == 0 ? 1 : -1;
+        } else {
+            sched_yield();
         }
     }
 
+    latency_record(LATENCY_REQUEST_CS, monotonic_ns() - start_ns);
     return 0;
 }
 
+int try_request_cs(const void *self) {
+    return request_cs_timeout(self, 0);
+}
+
+int request_cs(const void *self) {
+    return request_cs_timeout(self, UINT64_MAX);
+}
+
+int request_cs_for(const void *ptr, int ops) {
+    if (ops <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (request_cs(ptr) != 0) {
+        return -1;
+    }
+    return MIN(ops, MAX_CS_BATCH);
+}
+
+int cs_contended(const void *ptr) {
+    Process *self = (Process *) ptr;
+    for (;;) {
+        Message msg;
+        local_id id;
+        ReadStatus status = receive_any_non_blocking(self, &msg, &id);
+        if (status == READ_STATUS_EMPTY) {
+            break;
+        }
+        if (status != READ_STATUS_OK || cs_handle(self, id, &msg) != 0) {
+            return -1;
+        }
+    }
+    // the holder's own request is in the queue too
+    return self->queue.size > 1 ? 1 : 0;
+}
+
 int release_cs(const void * ptr) {
     Process *self = (Process *) ptr;
 
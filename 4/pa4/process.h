@@ -7,23 +7,36 @@
 
 #include "ipc.h"
 #include "banking.h"
+#include "barrier.h"
+#include "queue.h"
+#include "cs_batch.h"
 
 enum {
-    QUEUE_EMPTY_VALUE = INT16_MAX,
-    QUEUE_MAX_SIZE = MAX_PROCESS_ID + 1,
     INVALID_ID = -1,
-    FIRST_CHILD_ID = 1
+    FIRST_CHILD_ID = 1,
+    MAX_CS_BATCH = 16 ///< operations per acquisition even when nobody waits
 };
 
 
+/** Transport counters of one peer, written to the pipes log by free_channels. */
 typedef struct {
-    timestamp_t requests[QUEUE_MAX_SIZE];
-    local_id size;
-} Queue;
+    uint32_t sent_messages;
+    uint64_t sent_bytes;
+    uint32_t received_messages;
+    uint64_t received_bytes;
+    uint32_t reads;         ///< read syscalls, empty polls included
+    uint32_t writes;        ///< write syscalls
+    uint32_t read_eagain;
+    uint32_t write_eagain;
+    uint32_t partial_reads; ///< read returned less than asked
+    uint64_t blocked_ns;    ///< spinning on EAGAIN inside a blocking read or write
+} ChannelStats;
 
 typedef struct {
+    local_id peer;
     int rfd;
     int wfd;
+    ChannelStats stats;
 } Channel;
 
 typedef struct {
@@ -31,7 +44,9 @@ typedef struct {
     local_id channels_size;
     Channel *channels;
     Queue queue;
-    local_id done_count;
+    Barrier done;            ///< DONE of the children, counted by cs_receive_and_handle
+    bool replied[MAX_PROCESS_ID + 1];
+    uint8_t stale_replies[MAX_PROCESS_ID + 1]; ///< replies to withdrawn requests
 } Process;
 
 typedef int (*process_handler)(Process *);
@@ -42,13 +57,19 @@ int run_processes(
         process_handler child_handler
 );
 
-bool queue_empty(Queue *q);
+uint64_t monotonic_ns(void);
 
-void queue_put(Queue *q, local_id id, timestamp_t t);
+/**
+ * Wait for the CS up to timeout_ns after the requests are sent. Returns 0
+ * when entered, 1 when the request was withdrawn at the deadline, -1 on error.
+ */
+int request_cs_timeout(const void *self, uint64_t timeout_ns);
 
-local_id queue_min(Queue *q);
+/** Handle what has already arrived and withdraw unless the CS is free. */
+int try_request_cs(const void *self);
 
-timestamp_t queue_pop(Queue *q, local_id id);
+/** Receive one message and apply it to the queue, pass DONE to the barrier. */
+int cs_receive_and_handle(Process *self);
 
 int send_cs_multicast(Process* self, MessageType type);
 
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include "queue.h"
+#include "process.h"
+
+static bool before(const QueueEntry *a, const QueueEntry *b) {
+    if (a->time == b->time) {
+        return a->id < b->id;
+    }
+    return a->time < b->time;
+}
+
+static void place(Queue *q, size_t index, QueueEntry entry) {
+    q->heap[index] = entry;
+    q->positions[entry.id] = (int) index;
+}
+
+static void sift_up(Queue *q, size_t index) {
+    QueueEntry entry = q->heap[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!before(&entry, &q->heap[parent])) {
+            break;
+        }
+        place(q, index, q->heap[parent]);
+        index = parent;
+    }
+    place(q, index, entry);
+}
+
+static void sift_down(Queue *q, size_t index) {
+    QueueEntry entry = q->heap[index];
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= q->size) {
+            break;
+        }
+        if (child + 1 < q->size && before(&q->heap[child + 1], &q->heap[child])) {
+            child++;
+        }
+        if (!before(&q->heap[child], &entry)) {
+            break;
+        }
+        place(q, index, q->heap[child]);
+        index = child;
+    }
+    place(q, index, entry);
+}
+
+static int queue_grow(Queue *q, size_t capacity) {
+    QueueEntry *heap = realloc(q->heap, capacity * sizeof(QueueEntry));
+    if (heap == NULL) {
+        return -1;
+    }
+    q->heap = heap;
+    int *positions = realloc(q->positions, capacity * sizeof(int));
+    if (positions == NULL) {
+        return -1;
+    }
+    for (size_t i = q->capacity; i < capacity; i++) {
+        positions[i] = QUEUE_NO_POSITION;
+    }
+    q->positions = positions;
+    q->capacity = capacity;
+    return 0;
+}
+
+int queue_init(Queue *q) {
+    *q = (Queue) {.heap = NULL, .positions = NULL, .size = 0, .capacity = 0};
+    return queue_grow(q, QUEUE_INITIAL_CAPACITY);
+}
+
+void queue_free(Queue *q) {
+    free(q->heap);
+    free(q->positions);
+    *q = (Queue) {.heap = NULL, .positions = NULL, .size = 0, .capacity = 0};
+}
+
+bool queue_empty(Queue *q) {
+    return q->size == 0;
+}
+
+local_id queue_min(Queue *q) {
+    if (queue_empty(q)) {
+        return INVALID_ID;
+    }
+    return q->heap[0].id;
+}
+
+void queue_put(Queue *q, local_id id, timestamp_t t) {
+    if (id < 0) {
+        fprintf(stderr, "id out of bounds");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t) id >= q->capacity && queue_grow(q, MAX(2 * q->capacity, (size_t) id + 1)) != 0) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    if (q->positions[id] != QUEUE_NO_POSITION) {
+        fprintf(stderr, "Process %d already has a request\n", id);
+        exit(EXIT_FAILURE);
+    }
+
+    place(q, q->size++, (QueueEntry) {.time = t, .id = id});
+    sift_up(q, q->size - 1);
+}
+
+timestamp_t queue_pop(Queue *q, local_id id) {
+    if (id < 0 || (size_t) id >= q->capacity || q->positions[id] == QUEUE_NO_POSITION) {
+        fprintf(stderr, "id out of bounds");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t index = q->positions[id];
+    timestamp_t value = q->heap[index].time;
+    q->positions[id] = QUEUE_NO_POSITION;
+    q->size--;
+    if (index == q->size) {
+        return value;
+    }
+
+    place(q, index, q->heap[q->size]);
+    if (index > 0 && before(&q->heap[index], &q->heap[(index - 1) / 2])) {
+        sift_up(q, index);
+    } else {
+        sift_down(q, index);
+    }
+    return value;
+}
@@ -0,0 +1,43 @@
+#ifndef PROGRAM_QUEUE_H
+#define PROGRAM_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ipc.h"
+
+enum {
+    QUEUE_INITIAL_CAPACITY = MAX_PROCESS_ID + 1,
+    QUEUE_NO_POSITION = -1
+};
+
+typedef struct {
+    timestamp_t time;
+    local_id id;
+} QueueEntry;
+
+/**
+ * Binary min-heap of requests ordered by (time, id), at most one per process.
+ * positions maps an id to its heap index, so a release pops any entry in
+ * O(log n). Both arrays grow when an id doesn't fit.
+ */
+typedef struct {
+    QueueEntry *heap;
+    int *positions;
+    size_t size;
+    size_t capacity;
+} Queue;
+
+int queue_init(Queue *q);
+
+void queue_free(Queue *q);
+
+bool queue_empty(Queue *q);
+
+void queue_put(Queue *q, local_id id, timestamp_t t);
+
+local_id queue_min(Queue *q);
+
+timestamp_t queue_pop(Queue *q, local_id id);
+
+#endif //PROGRAM_QUEUE_H
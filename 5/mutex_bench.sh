@@ -0,0 +1,64 @@
+#!/bin/sh
+# Compare distributed mutex algorithms of pa5 by total CS messages, mean and
+# max request_cs latency and throughput of CS operations (printed lines),
+# one CSV row per configuration.
+#
+# usage: mutex_bench.sh PA5_BINARY [N...]
+# env:   ALGOS (default "ra sk mk rt"), ARITIES for rt (default "1 2 4"),
+#        READ_PERCENTS of read-mode entries for ra (default "0"),
+#        BATCHES of operations per acquisition (default "1")
+
+set -e
+
+binary=$(realpath "$1")
+shift
+sizes=${*:-2 4 6 8 10}
+algos=${ALGOS:-ra sk mk rt}
+arities=${ARITIES:-1 2 4}
+read_percents=${READ_PERCENTS:-0}
+batches=${BATCHES:-1}
+
+export LD_LIBRARY_PATH="${LD_LIBRARY_PATH:+$LD_LIBRARY_PATH:}$(cd "$(dirname "$0")" && pwd)/pa5/lib64"
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+cd "$workdir"
+
+echo "algo,arity,read_percent,batch,n,cs,messages,messages_per_cs,mean_wait_us,max_wait_us,elapsed_ms,ops_per_s"
+for n in $sizes; do
+    for algo in $algos; do
+        algo_arities=-
+        if [ "$algo" = rt ]; then
+            algo_arities=$arities
+        fi
+        algo_read_percents=0
+        if [ "$algo" = ra ]; then
+            algo_read_percents=$read_percents
+        fi
+        for arity in $algo_arities; do
+            for read_percent in $algo_read_percents; do
+                for batch in $batches; do
+                    tree=""
+                    if [ "$arity" != - ]; then
+                        tree="--tree-arity $arity"
+                    fi
+                    start=$(date +%s%N)
+                    # shellcheck disable=SC2086
+                    "$binary" -p "$n" --mutexl --mutex-algo "$algo" $tree --read-percent "$read_percent" \
+                        --batch "$batch" --stats 2>stats.txt >/dev/null
+                    elapsed_ms=$((($(date +%s%N) - start) / 1000000))
+                    awk -v algo="$algo" -v arity="$arity" -v reads="$read_percent" -v batch="$batch" -v n="$n" \
+                        -v ms="$elapsed_ms" '
+                        /^stats:/ {
+                            cs += $8; messages += $11; wait += $15
+                            if ($22 > max_wait) max_wait = $22
+                        }
+                        END {
+                            ops = 5 * n * (n + 1) / 2
+                            printf "%s,%s,%d,%d,%d,%d,%d,%.2f,%.1f,%d,%d,%.1f\n", algo, arity, reads, batch, n, cs,
+                                   messages, messages / cs, wait / cs, max_wait, ms, ops * 1000 / ms
+                        }' stats.txt
+                done
+            done
+        done
+    done
+done
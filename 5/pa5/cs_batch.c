@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <sys/param.h>
+
+#include "cs_batch.h"
+#include "pa2345.h"
+
+int child_work_batched(const void *self, local_id id, int batch) {
+    int n = id * 5;
+    char buffer[1024];
+    for (int i = 1; i < n + 1;) {
+        int ops = request_cs_for(self, MIN(batch, n - i + 1));
+        if (ops < 0) {
+            perror("Child mutex request");
+            return -1;
+        }
+        for (int end = i + ops; i < end;) {
+            sprintf(buffer, log_loop_operation_fmt, id, i, n);
+            print(buffer);
+            i++;
+            int contended = i < end ? cs_contended(self) : 0;
+            if (contended < 0) {
+                perror("Child mutex poll");
+                return -1;
+            }
+            if (contended) {
+                break;
+            }
+        }
+        if (release_cs(self) != 0) {
+            perror("Child mutex release");
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "process.h"
+#include "maekawa.h"
+
+extern timestamp_t local_time;
+
+static int dispatch(Process *self, local_id from, MessageType type, timestamp_t time);
+
+static uint16_t bit(local_id id) {
+    return (uint16_t) (1u << id);
+}
+
+static bool before(const MaekawaRequest *a, const MaekawaRequest *b) {
+    if (a->time == b->time) {
+        return a->id < b->id;
+    }
+    return a->time < b->time;
+}
+
+static int grid_size(local_id children) {
+    int size = 1;
+    while (size * size < children) {
+        size++;
+    }
+    return size;
+}
+
+static uint16_t grid_quorum(local_id id, local_id children) {
+    int size = grid_size(children);
+    int row = (id - FIRST_CHILD_ID) / size;
+    int col = (id - FIRST_CHILD_ID) % size;
+    uint16_t quorum = 0;
+    for (local_id other = FIRST_CHILD_ID; other <= children; other++) {
+        int index = other - FIRST_CHILD_ID;
+        if (index / size == row || index % size == col) {
+            quorum |= bit(other);
+        }
+    }
+    return quorum;
+}
+
+/** Messages to itself are delivered without I/O, process is a member of its own quorum. */
+static int send_mk(Process *self, local_id dst, MessageType type) {
+    if (dst == self->id) {
+        return dispatch(self, dst, type, self->mk.request_time);
+    }
+    local_time++;
+    if (type == CS_REQUEST) {
+        return send_cs_payload(self, dst, type, &self->mk.request_time, sizeof(timestamp_t));
+    }
+    return send_cs(self, dst, type);
+}
+
+static int send_quorum(Process *self, MessageType type) {
+    for (local_id dst = FIRST_CHILD_ID; dst < self->channels_size; dst++) {
+        if ((self->mk.quorum & bit(dst)) && send_mk(self, dst, type) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static size_t queue_min(const Maekawa *mk) {
+    size_t min = 0;
+    for (size_t i = 1; i < mk->queue_len; i++) {
+        if (before(&mk->queue[i], &mk->queue[min])) {
+            min = i;
+        }
+    }
+    return min;
+}
+
+static MaekawaRequest queue_pop_min(Maekawa *mk) {
+    size_t min = queue_min(mk);
+    MaekawaRequest request = mk->queue[min];
+    mk->queue[min] = mk->queue[--mk->queue_len];
+    return request;
+}
+
+static int vote_for_next(Process *self) {
+    Maekawa *mk = &self->mk;
+    mk->voted = false;
+    mk->inquired = false;
+    if (mk->queue_len == 0) {
+        return 0;
+    }
+    mk->vote = queue_pop_min(mk);
+    mk->voted = true;
+    return send_mk(self, mk->vote.id, CS_REPLY);
+}
+
+static int voter_request(Process *self, MaekawaRequest request) {
+    Maekawa *mk = &self->mk;
+    if (!mk->voted) {
+        mk->vote = request;
+        mk->voted = true;
+        mk->inquired = false;
+        return send_mk(self, request.id, CS_REPLY);
+    }
+
+    MaekawaRequest *head = mk->queue_len > 0 ? &mk->queue[queue_min(mk)] : NULL;
+    if (!before(&request, &mk->vote) || (head != NULL && before(head, &request))) {
+        request.failed = true;
+        mk->queue[mk->queue_len++] = request;
+        return send_mk(self, request.id, CS_FAILED);
+    }
+
+    // request is the best one now, previous head will wait for it
+    mk->queue[mk->queue_len++] = request;
+    if (head != NULL && !head->failed) {
+        head->failed = true;
+        if (send_mk(self, head->id, CS_FAILED) != 0) {
+            return -1;
+        }
+    }
+    if (!mk->inquired) {
+        mk->inquired = true;
+        return send_mk(self, mk->vote.id, CS_INQUIRE);
+    }
+    return 0;
+}
+
+static int voter_yield(Process *self) {
+    Maekawa *mk = &self->mk;
+    mk->vote.failed = true;
+    mk->queue[mk->queue_len++] = mk->vote;
+    return vote_for_next(self);
+}
+
+static int requester_yield(Process *self, local_id voter) {
+    self->mk.grants &= ~bit(voter);
+    return send_mk(self, voter, CS_YIELD);
+}
+
+static int requester_inquire(Process *self, local_id voter) {
+    Maekawa *mk = &self->mk;
+    if (mk->in_cs) {
+        // the voter has a waiter, mk_contended ends a batch for it
+        mk->inquiries |= bit(voter);
+        return 0;
+    }
+    if (mk->request_time == EMPTY_REQUEST_TIME || mk->grants == mk->quorum || !(mk->grants & bit(voter))) {
+        return 0;
+    }
+    if (mk->failed) {
+        return requester_yield(self, voter);
+    }
+    mk->inquiries |= bit(voter);
+    return 0;
+}
+
+static int requester_failed(Process *self) {
+    Maekawa *mk = &self->mk;
+    mk->failed = true;
+    for (local_id voter = FIRST_CHILD_ID; voter < self->channels_size; voter++) {
+        if ((mk->inquiries & bit(voter)) && (mk->grants & bit(voter))) {
+            if (requester_yield(self, voter) != 0) {
+                return -1;
+            }
+        }
+    }
+    mk->inquiries = 0;
+    return 0;
+}
+
+static int dispatch(Process *self, local_id from, MessageType type, timestamp_t time) {
+    switch ((int) type) {
+        case CS_REQUEST:
+            return voter_request(self, (MaekawaRequest) {.time = time, .id = from, .failed = false});
+        case CS_RELEASE:
+            return vote_for_next(self);
+        case CS_YIELD:
+            return voter_yield(self);
+        case CS_REPLY:
+            self->mk.grants |= bit(from);
+            return 0;
+        case CS_INQUIRE:
+            return requester_inquire(self, from);
+        case CS_FAILED:
+            return requester_failed(self);
+        default:
+            return -1;
+    }
+}
+
+static void mk_init(void *ptr) {
+    Process *self = (Process *) ptr;
+    self->mk = (Maekawa) {
+            .quorum = grid_quorum(self->id, self->channels_size - 1),
+            .request_time = EMPTY_REQUEST_TIME
+    };
+}
+
+static int mk_handle(void *ptr, local_id from, const Message *msg) {
+    Process *self = (Process *) ptr;
+    timestamp_t time = msg->s_header.s_local_time;
+    if (msg->s_header.s_type == CS_REQUEST) {
+        memcpy(&time, msg->s_payload, sizeof(timestamp_t));
+    }
+    return dispatch(self, from, msg->s_header.s_type, time);
+}
+
+static int mk_request(void *ptr, lock_id lock, LockMode mode) {
+    Process *self = (Process *) ptr;
+    Maekawa *mk = &self->mk;
+
+    local_time++;
+    mk->request_time = get_lamport_time();
+    mk->grants = 0;
+    mk->inquiries = 0;
+    mk->failed = false;
+    return send_quorum(self, CS_REQUEST);
+}
+
+static bool mk_try_enter(void *ptr, lock_id lock) {
+    Process *self = (Process *) ptr;
+    Maekawa *mk = &self->mk;
+    if (mk->request_time == EMPTY_REQUEST_TIME || mk->in_cs || mk->grants != mk->quorum) {
+        return false;
+    }
+    mk->in_cs = true;
+    return true;
+}
+
+static int mk_release(void *ptr, lock_id lock) {
+    Process *self = (Process *) ptr;
+    Maekawa *mk = &self->mk;
+
+    if (!mk->in_cs) {
+        fprintf(stderr, "Process is not mutex owner");
+        return -1;
+    }
+    mk->in_cs = false;
+    mk->request_time = EMPTY_REQUEST_TIME;
+    mk->grants = 0;
+    return send_quorum(self, CS_RELEASE);
+}
+
+/** Others queue at the voter part of the holder, or their voters inquire. */
+static bool mk_contended(void *ptr, lock_id lock) {
+    Maekawa *mk = &((Process *) ptr)->mk;
+    return mk->queue_len > 0 || mk->inquiries != 0;
+}
+
+const MutexOps maekawa_mutex = {
+        .name = "mk",
+        .init = mk_init,
+        .request = mk_request,
+        .try_enter = mk_try_enter,
+        .release = mk_release,
+        .contended = mk_contended,
+        .handle = mk_handle
+};
@@ -0,0 +1,44 @@
+#ifndef PROGRAM_MAEKAWA_H
+#define PROGRAM_MAEKAWA_H
+
+#include <stdbool.h>
+
+#include "ipc.h"
+#include "mutex.h"
+
+enum {
+    MK_MAX_SIZE = MAX_PROCESS_ID + 1
+};
+
+typedef struct {
+    timestamp_t time;
+    local_id id;
+    bool failed; ///< FAILED was sent to the requester
+} MaekawaRequest;
+
+/**
+ * Children are placed row by row on a square grid, quorum of a process is
+ * its row and column, i.e. about 2 * sqrt(n) processes including itself.
+ * Sets of processes are bitmasks of ids.
+ */
+typedef struct {
+    uint16_t quorum;
+
+    // requester
+    timestamp_t request_time;
+    bool in_cs;
+    bool failed;
+    uint16_t grants;
+    uint16_t inquiries;
+
+    // voter
+    bool voted;
+    bool inquired;
+    MaekawaRequest vote;
+    MaekawaRequest queue[MK_MAX_SIZE];
+    local_id queue_len;
+} Maekawa;
+
+extern const MutexOps maekawa_mutex;
+
+#endif //PROGRAM_MAEKAWA_H
@@ -4,12 +4,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <sys/param.h>
 
 #include "banking.h"
 #include "common.h"
 #include "process.h"
 #include "pa2345.h"
+#include "trace.h"
+#include "msgtrace.h"
+#include "latency.h"
 
 FILE *pipes_log_fd;
 FILE *event_log_fd;
@@ -20,50 +24,207 @@ static struct {
     bool valid;
     local_id n;
     bool use_mutex;
+    bool print_stats;
+    const MutexOps *mutex;
+    uint8_t tree_arity;
+    lock_id locks_count;
+    int read_percent;
+    bool use_async;
+    int batch;
+    int lock_timeout_ms;
+    bool trace;
+    bool msg_trace;
+    bool latency;
 } arguments = {
         .valid = true,
         .use_mutex = false,
+        .print_stats = false,
+        .mutex = &ricart_agrawala_mutex,
+        .tree_arity = RAYMOND_DEFAULT_ARITY,
+        .locks_count = 1,
+        .read_percent = 0,
+        .use_async = false,
+        .batch = 1,
+        .lock_timeout_ms = 0,
+        .trace = false,
+        .msg_trace = false,
+        .latency = false,
         .n = 0
 };
 
+static const MutexOps *const mutex_algorithms[] = {
+        &ricart_agrawala_mutex,
+        &suzuki_kasami_mutex,
+        &maekawa_mutex,
+        &raymond_mutex
+};
+
+static const MutexOps *find_mutex(const char *name) {
+    for (size_t i = 0; i < sizeof(mutex_algorithms) / sizeof(mutex_algorithms[0]); i++) {
+        if (strcmp(mutex_algorithms[i]->name, name) == 0) {
+            return mutex_algorithms[i];
+        }
+    }
+    return NULL;
+}
+
+/** Integer option in [min;max], checked before it is narrowed to the type of its field. */
+static int parse_ranged(const char *option, const char *arg, int min, int max) {
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < min || value > max) {
+        fprintf(stderr, "%s must be in [%d;%d]: %s\n", option, min, max, arg);
+        exit(EXIT_FAILURE);
+    }
+    return (int) value;
+}
+
 void parse_arguments(int argc, char *argv[]) {
     int opt;
     static struct option long_options[] = {
             {"mutexl", no_argument, 0, 'm' },
+            {"mutex-algo", required_argument, 0, 'a' },
+            {"stats", no_argument, 0, 's' },
+            {"tree-arity", required_argument, 0, 't' },
+            {"locks", required_argument, 0, 'l' },
+            {"read-percent", required_argument, 0, 'r' },
+            {"async", no_argument, 0, 'y' },
+            {"batch", required_argument, 0, 'b' },
+            {"lock-timeout", required_argument, 0, 'o' },
+            {"trace", no_argument, 0, 'T' },
+            {"msg-trace", no_argument, 0, 'M' },
+            {"latency", no_argument, 0, 'L' },
             {0, 0, 0, 0 }
     };
 
     while ((opt = getopt_long(argc, argv, "p:m:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'p':
-                arguments.n = atoi(optarg);
+                arguments.n = (local_id) parse_ranged("-p", optarg, 1, MAX_PROCESS_ID);
                 break;
             case 'm':
                 arguments.use_mutex = true;
                 break;
+            case 'a':
+                arguments.mutex = find_mutex(optarg);
+                if (arguments.mutex == NULL) {
+                    fprintf(stderr, "Unknown mutex algorithm: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                arguments.print_stats = true;
+                break;
+            case 't':
+                arguments.tree_arity = (uint8_t) parse_ranged("--tree-arity", optarg, 1, MAX_PROCESS_ID);
+                break;
+            case 'l':
+                arguments.locks_count = (lock_id) parse_ranged("--locks", optarg, 1, MAX_LOCKS);
+                break;
+            case 'r':
+                arguments.read_percent = parse_ranged("--read-percent", optarg, 0, 100);
+                break;
+            case 'y':
+                arguments.use_async = true;
+                break;
+            case 'b':
+                arguments.batch = parse_ranged("--batch", optarg, 1, INT_MAX);
+                break;
+            case 'o':
+                arguments.lock_timeout_ms = parse_ranged("--lock-timeout", optarg, 0, INT_MAX);
+                break;
+            case 'T':
+                arguments.trace = true;
+                break;
+            case 'M':
+                arguments.msg_trace = true;
+                break;
+            case 'L':
+                arguments.latency = true;
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-p N] [--mutex]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-p N] [--mutexl] [--mutex-algo ra|sk|mk|rt] [--tree-arity K] [--locks K] [--read-percent P] [--async] [--batch B] [--lock-timeout MS] [--trace] [--msg-trace] [--latency] [--stats]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
+    if (arguments.locks_count == 0 || arguments.locks_count > MAX_LOCKS
+        || (arguments.locks_count > 1 && !arguments.mutex->named_locks)) {
+        fprintf(stderr, "Mutex %s can't provide %d locks\n", arguments.mutex->name, arguments.locks_count);
+        exit(EXIT_FAILURE);
+    }
+    if (arguments.read_percent > 0 && !arguments.mutex->named_locks) {
+        fprintf(stderr, "Mutex %s can't provide %d%% reads\n", arguments.mutex->name, arguments.read_percent);
+        exit(EXIT_FAILURE);
+    }
+    if (arguments.batch > 1 && (arguments.use_async || arguments.read_percent > 0 || arguments.locks_count > 1)) {
+        fprintf(stderr, "Batch of %d works with exclusive default lock only\n", arguments.batch);
+        exit(EXIT_FAILURE);
+    }
+    if (arguments.lock_timeout_ms > 0
+        && (arguments.mutex->withdraw == NULL || arguments.use_async || arguments.batch > 1)) {
+        fprintf(stderr, "Mutex %s can't time out requests here\n", arguments.mutex->name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/** Same deterministic read/write mix in every run. */
+static LockMode iteration_mode(local_id id, int i) {
+    uint32_t hash = (uint32_t) i * 2654435761u ^ (uint32_t) id * 40503u;
+    return (int) (hash % 100) < arguments.read_percent ? LOCK_READ : LOCK_WRITE;
+}
+
+static void on_lock_ready(void *self, lock_id lock, void *arg) {
+    *(bool *) arg = true;
+}
+
+/** Requests that time out are withdrawn and made again with twice the timeout. */
+static int request_lock_retrying(Process *self, lock_id lock, LockMode mode) {
+    if (arguments.lock_timeout_ms <= 0) {
+        return request_lock_mode(self, lock, mode);
+    }
+    uint64_t timeout_ns = arguments.lock_timeout_ms * 1000000ull;
+    int result;
+    while ((result = request_lock_timeout(self, lock, mode, timeout_ns)) == 1) {
+        timeout_ns = timeout_ns > UINT64_MAX / 2 ? UINT64_MAX : timeout_ns * 2;
+    }
+    return result;
 }
 
 static int child_work(Process *self) {
+    if (arguments.use_mutex && arguments.batch > 1) {
+        return child_work_batched(self, self->id, arguments.batch);
+    }
     int n = self->id * 5;
+    // processes with different locks don't exclude each other
+    lock_id lock = self->id % arguments.locks_count;
     char buffer[1024];
     for (int i = 1; i < n + 1; i++) {
-        if (arguments.use_mutex) {
-            if (request_cs(self) != 0) {
+        bool entered = !arguments.use_mutex;
+        if (arguments.use_mutex && arguments.use_async) {
+            if (request_lock_async(self, lock, iteration_mode(self->id, i), on_lock_ready, &entered) != 0) {
+                perror("Child mutex request");
+                return -1;
+            }
+        } else if (arguments.use_mutex) {
+            if (request_lock_retrying(self, lock, iteration_mode(self->id, i)) != 0) {
                 perror("Child mutex request");
                 return -1;
             }
+            entered = true;
         }
 
+        // prepared while the requests are in flight
         sprintf(buffer, log_loop_operation_fmt, self->id, i, n);
+        while (!entered) {
+            if (cs_poll(self) < 0) {
+                perror("Child mutex poll");
+                return -1;
+            }
+        }
         print(buffer);
 
         if (arguments.use_mutex) {
-            if (release_cs(self) != 0) {
+            if (release_lock(self, lock) != 0) {
                 perror("Child mutex release");
                 return -1;
             }
@@ -94,21 +255,13 @@ static int child_run(Process *self) {
             }
     };
     memcpy(start_message.s_payload, str_buffer, str_size);
-    if (send_multicast(self, &start_message) != 0) {
-        perror("Child multicast");
-        return -1;
-    }
 
     // wait all started
-    for (local_id i = FIRST_CHILD_ID; i < self->channels_size; i++) {
-        if (i == self->id) {
-            continue;
-        }
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("Child receive");
-            return -1;
-        }
+    Barrier started;
+    barrier_init(&started, STARTED);
+    if (barrier_wait(self, &started, &start_message) != 0) {
+        perror("Child barrier");
+        return -1;
     }
     time = get_lamport_time();
     printf(log_received_all_started_fmt, time, self->id);
@@ -137,61 +290,46 @@ static int child_run(Process *self) {
             }
     };
     memcpy(finish_message.s_payload, str_buffer, str_size);
-    if (send_multicast(self, &finish_message) != 0) {
-        perror("Child work multicast");
+    if (barrier_arrive(self, &self->done, &finish_message) != 0) {
+        perror("Child barrier");
         return -1;
     }
 
-    while (self->done_count != self->channels_size - 2) {
-        Message msg;
-        local_id id = receive_any(self, &msg);
-        if (id == -1) {
+    // peers still in the CS protocol need answers until the barrier is released
+    while (!self->done.released) {
+        if (cs_receive_and_handle(self) != 0) {
             return -1;
         }
-        if (arguments.use_mutex) {
-            if (msg.s_header.s_type == CS_REQUEST) {
-                local_time++;
-                if (send_cs(self, id, CS_REPLY) != 0) {
-                    return -1;
-                }
-            } else if (msg.s_header.s_type == DONE) {
-                self->done_count++;
-            } else {
-                return -1;
-            }
-        } else {
-            if (msg.s_header.s_type == DONE) {
-                self->done_count++;
-            } else {
-                return -1;
-            }
-        }
     }
 
     time = get_lamport_time();
     printf(log_received_all_done_fmt, time, self->id);
     fprintf(event_log_fd, log_received_all_done_fmt, time, self->id);
     fflush(event_log_fd);
+
+    if (arguments.print_stats) {
+        fprintf(stderr, "stats: process %d mutex %s entered CS %d times, sent %d CS messages, waited %lu us, "
+                "reused %d permissions, max wait %lu us, withdrew %d requests\n",
+                self->id, self->mutex->name, self->stats.cs_count, self->stats.messages_sent,
+                (unsigned long) (self->stats.wait_ns / 1000), self->stats.permissions_reused,
+                (unsigned long) (self->stats.max_wait_ns / 1000), self->stats.withdrawn);
+    }
     return 0;
 }
 
 static int parent_run(Process *self) {
     // wait all started
-    for (local_id i = FIRST_CHILD_ID; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != STARTED) {
-            perror("Parent receive");
-            return -1;
-        }
+    Barrier started;
+    barrier_init(&started, STARTED);
+    if (barrier_wait(self, &started, NULL) != 0) {
+        perror("Parent barrier");
+        return -1;
     }
 
     // wait all done
-    for (local_id i = FIRST_CHILD_ID; i < self->channels_size; i++) {
-        Message msg;
-        if (receive(self, i, &msg) != 0 || msg.s_header.s_type != DONE) {
-            perror("Parent receive");
-            return -1;
-        }
+    if (barrier_wait(self, &self->done, NULL) != 0) {
+        perror("Parent barrier");
+        return -1;
     }
     return 0;
 }
@@ -213,7 +351,16 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
     current_id = PARENT_ID;
-    if (run_processes(arguments.n + 1, parent_run, child_run) != 0) {
+    if (arguments.trace && trace_open(trace_json) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (arguments.msg_trace) {
+        msgtrace_enable();
+    }
+    if (arguments.latency) {
+        latency_enable();
+    }
+    if (run_processes(arguments.n + 1, parent_run, child_run, arguments.mutex, arguments.tree_arity) != 0) {
         fclose(pipes_log_fd);
         fclose(event_log_fd);
         return EXIT_FAILURE;
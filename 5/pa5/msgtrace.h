@@ -0,0 +1,59 @@
+#ifndef PROGRAM_MSGTRACE_H
+#define PROGRAM_MSGTRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ipc.h"
+
+/** Printed with the id of the process, e.g. msgtrace.3.bin. */
+static const char * const msgtrace_file_fmt = "msgtrace.%d.bin";
+
+enum {
+    MSGTRACE_MAGIC = 0x4d534754,    ///< "MSGT"
+    MSGTRACE_VERSION = 1,
+    MSGTRACE_CAPACITY = 1 << 16,    ///< records in the ring, older ones are overwritten
+    MSGTRACE_PAYLOAD_PREFIX = 16,   ///< bytes of the payload kept in a record
+    MSGTRACE_HEADER_SIZE = 64
+};
+
+/** One send or receive, the process that wrote the record is src of a send and dst of a receive. */
+typedef struct {
+    uint64_t tsc;          ///< rdtsc, or CLOCK_MONOTONIC ns where there is none
+    timestamp_t lamport;   ///< s_local_time of the message
+    uint16_t payload_len;
+    int16_t type;
+    local_id src;
+    local_id dst;
+    char payload[MSGTRACE_PAYLOAD_PREFIX];
+} MsgTraceRecord;
+
+/** Start of the file, padded to MSGTRACE_HEADER_SIZE, the ring follows. */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    local_id process;
+    uint32_t capacity;
+    uint64_t head;         ///< records ever written, the ring holds the last capacity of them
+    uint64_t tsc_start;    ///< tsc and ns at open and close convert tsc to time
+    uint64_t ns_start;
+    uint64_t tsc_end;      ///< 0 if the process didn't close the trace
+    uint64_t ns_end;
+} MsgTraceHeader;
+
+/**
+ * Record every message of the processes forked after this in
+ * msgtrace.<id>.bin, a ring of fixed-size binary records mapped into each
+ * process. Decoded offline by msgtrace_decode. Must be called before fork.
+ */
+void msgtrace_enable(void);
+
+/** Map the file of the current process, a no-op unless enabled. */
+int msgtrace_open(local_id id);
+
+/** Record a message before it is written or after it is read. */
+void msgtrace_record(local_id src, local_id dst, const Message *msg);
+
+void msgtrace_close(void);
+
+#endif //PROGRAM_MSGTRACE_H
@@ -0,0 +1,59 @@
+#ifndef PROGRAM_MUTEX_H
+#define PROGRAM_MUTEX_H
+
+#include <stdbool.h>
+
+#include "ipc.h"
+
+enum {
+    CS_TOKEN = CS_RELEASE + 1, ///< message with SuzukiKasamiToken
+    CS_INQUIRE,                ///< empty message
+    CS_YIELD,                  ///< empty message
+    CS_FAILED,                 ///< empty message
+    CS_PRIVILEGE               ///< empty message
+};
+
+typedef uint8_t lock_id;
+
+typedef enum {
+    LOCK_WRITE = 0, ///< exclusive
+    LOCK_READ       ///< shared with other readers
+} LockMode;
+
+enum {
+    MAX_LOCKS = 8,
+    MAX_CS_BATCH = 16, ///< operations per acquisition even when nobody waits
+    DEFAULT_LOCK = 0 ///< lock used by request_cs and release_cs
+};
+
+/**
+ * Distributed mutual exclusion algorithm used by request_cs and release_cs.
+ * request only sends the requests, try_enter is checked after every handled
+ * message and enters the CS once the algorithm allows it. withdraw is
+ * optional and cancels a request that hasn't entered yet. contended tells
+ * the holder of a lock whether others wait for it. handle is called for
+ * every CS message. Algorithms without named_locks provide exclusive
+ * DEFAULT_LOCK only and ignore lock and mode.
+ */
+typedef struct {
+    const char *name;
+    bool named_locks;
+    void (*init)(void *self);
+    int (*request)(void *self, lock_id lock, LockMode mode);
+    bool (*try_enter)(void *self, lock_id lock);
+    int (*release)(void *self, lock_id lock);
+    int (*withdraw)(void *self, lock_id lock);
+    bool (*contended)(void *self, lock_id lock);
+    int (*handle)(void *self, local_id from, const Message *msg);
+} MutexOps;
+
+typedef struct {
+    int cs_count;
+    int messages_sent;
+    int permissions_reused; ///< peers not asked again on entry
+    int withdrawn;          ///< requests given up at a deadline
+    uint64_t wait_ns; ///< time spent in request_cs
+    uint64_t max_wait_ns;
+} MutexStats;
+
+#endif //PROGRAM_MUTEX_H
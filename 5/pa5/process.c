@@ -2,8 +2,11 @@
 // Created by Vyacheslav Lebedev on 16.09.2024.
 //
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <sys/wait.h>
 #include <stdio.h>
+#include <time.h>
 #include <sched.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,6 +18,9 @@
 
 #include "ipc.h"
 #include "process.h"
+#include "latency.h"
+#include "trace.h"
+#include "msgtrace.h"
 
 extern FILE *pipes_log_fd;
 extern FILE *event_log_fd;
@@ -32,24 +38,28 @@ typedef enum {
     READ_STATUS_ERROR
 } ReadStatus;
 
-static ReadStatus read_non_blocking(const int fd, char *buffer, const size_t buffer_size) {
+static ReadStatus read_non_blocking(Channel *const cnl, char *buffer, const size_t buffer_size) {
     if (buffer_size == 0) {
         return READ_STATUS_OK;
     }
     ssize_t bytes_read;
-    bytes_read = read(fd, buffer, buffer_size);
+    cnl->stats.reads++;
+    bytes_read = read(cnl->rfd, buffer, buffer_size);
     if (bytes_read == 0) {
         return READ_STATUS_CLOSED;
     } else if (bytes_read < 0) {
         if (errno == EAGAIN) {
+            cnl->stats.read_eagain++;
             return READ_STATUS_EMPTY;
         } else {
             return READ_STATUS_ERROR;
         }
     }
     size_t ptr = bytes_read;
-    while (bytes_read < buffer_size) {
-        bytes_read = read(fd, buffer + ptr, buffer_size - ptr);
+    while (ptr < buffer_size) {
+        cnl->stats.partial_reads++;
+        cnl->stats.reads++;
+        bytes_read = read(cnl->rfd, buffer + ptr, buffer_size - ptr);
         if (bytes_read <= 0) {
             return READ_STATUS_ERROR;
         }
@@ -58,50 +68,87 @@ static ReadStatus read_non_blocking(const int fd, char *buffer, const size_t buf
     return READ_STATUS_OK;
 }
 
-static int read_blocking(const int fd, char *buffer, const size_t size) {
+static int read_blocking(Channel *const cnl, char *buffer, const size_t size) {
     ReadStatus status;
-    do {
-        status = read_non_blocking(fd, buffer, size);
-    } while (status == READ_STATUS_EMPTY);
+    uint64_t blocked_since = 0;
+    while ((status = read_non_blocking(cnl, buffer, size)) == READ_STATUS_EMPTY) {
+        if (blocked_since == 0) {
+            blocked_since = monotonic_ns();
+        }
+    }
+    if (blocked_since != 0) {
+        cnl->stats.blocked_ns += monotonic_ns() - blocked_since;
+    }
     return status;
 }
 
-static int channel_read_blocking(const Channel *const cnl, Message *msg) {
-    if (read_blocking(cnl->rfd, (char *) &msg->s_header, sizeof(MessageHeader)) != 0) {
+static int read_body(Channel *const cnl, Message *msg) {
+    const size_t len = msg->s_header.s_payload_len;
+    if (read_blocking(cnl, msg->s_payload, len) != 0) {
+        return -1;
+    }
+    if (latency_enabled()) {
+        latency_received(cnl->peer, monotonic_ns());
+    }
+    cnl->stats.received_messages++;
+    cnl->stats.received_bytes += sizeof(MessageHeader) + len;
+    return 0;
+}
+
+static int channel_read_blocking(Channel *const cnl, Message *msg) {
+    if (read_blocking(cnl, (char *) &msg->s_header, sizeof(MessageHeader)) != 0) {
         perror("Read blocking header");
         return -1;
     }
-    if (read_blocking(cnl->rfd, msg->s_payload, msg->s_header.s_payload_len) != 0) {
+    if (read_body(cnl, msg) != 0) {
         perror("Read blocking body");
         return -1;
     }
     return 0;
 }
 
-static ReadStatus channel_read_non_blocking(const Channel *const cnl, Message *msg) {
+static ReadStatus channel_read_non_blocking(Channel *const cnl, Message *msg) {
     ReadStatus status;
-    status = read_non_blocking(cnl->rfd, (char *) &msg->s_header, sizeof(MessageHeader));
+    status = read_non_blocking(cnl, (char *) &msg->s_header, sizeof(MessageHeader));
     if (status != READ_STATUS_OK) {
         return status;
     }
-    if (read_blocking(cnl->rfd, msg->s_payload, msg->s_header.s_payload_len) != 0) {
+    if (read_body(cnl, msg) != 0) {
         return READ_STATUS_ERROR;
     }
     return READ_STATUS_OK;
 }
 
-static int channel_write(const Channel *const cnl, const Message *const msg) {
+/** A full pipe is waited out, the peer drains it on its next receive. */
+static int channel_write(Channel *const cnl, const Message *const msg) {
     const size_t buffer_size = sizeof(MessageHeader) + msg->s_header.s_payload_len;
-    const char *buffer = (char *) msg;
+    const char *buffer = (const char *) msg;
+    if (latency_enabled()) {
+        latency_sent(cnl->peer, monotonic_ns());
+    }
     size_t ptr = 0;
+    uint64_t blocked_since = 0;
     do {
+        cnl->stats.writes++;
         ssize_t written = write(cnl->wfd, buffer + ptr, buffer_size - ptr);
-        if (written == -1) {
+        if (written == -1 && errno == EAGAIN) {
+            cnl->stats.write_eagain++;
+            if (blocked_since == 0) {
+                blocked_since = monotonic_ns();
+            }
+            sched_yield();
+            continue;
+        } else if (written == -1) {
             perror("Write err");
             return -1;
         }
         ptr += written;
     } while (ptr != buffer_size);
+    if (blocked_since != 0) {
+        cnl->stats.blocked_ns += monotonic_ns() - blocked_since;
+    }
+    cnl->stats.sent_messages++;
+    cnl->stats.sent_bytes += buffer_size;
     return 0;
 }
 
@@ -112,10 +159,13 @@ int receive(void *self, local_id from, Message *msg) {
     }
     Channel *channel = &process->channels[from];
 
+    uint64_t start_ns = trace_enabled() ? monotonic_ns() : 0;
     if (channel_read_blocking(channel, msg) != 0) {
         fprintf(stderr, "Unable to read blocking from id: %d \n", from);
         return -1;
     }
+    trace_message(TRACE_RECEIVE, from, msg, start_ns);
+    msgtrace_record(from, process->id, msg);
 
     if (msg->s_header.s_magic != MESSAGE_MAGIC) {
         return -1;
@@ -124,38 +174,56 @@ int receive(void *self, local_id from, Message *msg) {
     return 0;
 }
 
-int receive_any(void *self, Message *msg) {
-    Process *process = (Process *) self;
-    ReadStatus status;
+/** One pass over all channels, READ_STATUS_CLOSED means every channel is closed. */
+static ReadStatus receive_any_non_blocking(Process *process, Message *msg, local_id *from) {
     bool empty_exists = false;
-    do {
-        empty_exists = false;
-        for (local_id id = 0; id < process->channels_size; id++) {
-            if (id == process->id) {
-                continue;
+    for (local_id id = 0; id < process->channels_size; id++) {
+        if (id == process->id) {
+            continue;
+        }
+        Channel *channel = &process->channels[id];
+        uint64_t start_ns = trace_enabled() ? monotonic_ns() : 0;
+        switch (channel_read_non_blocking(channel, msg)) {
+            case READ_STATUS_OK: {
+                trace_message(TRACE_RECEIVE, id, msg, start_ns);
+                msgtrace_record(id, process->id, msg);
+                local_time = MAX(local_time, msg->s_header.s_local_time) + 1;
+                *from = id;
+                return READ_STATUS_OK;
             }
-            Channel *channel = &process->channels[id];
-            status = channel_read_non_blocking(channel, msg);
-            switch (status) {
-                case READ_STATUS_OK: {
-                    local_time = MAX(local_time, msg->s_header.s_local_time) + 1;
-                    return id;
-                }
-                case READ_STATUS_ERROR: {
-                    return (local_id) -1;
-                }
-                case READ_STATUS_EMPTY: {
-                    empty_exists = true;
-                    break;
-                }
-                case READ_STATUS_CLOSED: {
-                    continue;
-                }
+            case READ_STATUS_ERROR: {
+                return READ_STATUS_ERROR;
+            }
+            case READ_STATUS_EMPTY: {
+                empty_exists = true;
+                break;
+            }
+            case READ_STATUS_CLOSED: {
+                continue;
             }
         }
+    }
+    return empty_exists ? READ_STATUS_EMPTY : READ_STATUS_CLOSED;
+}
+
+int receive_any(void *self, Message *msg) {
+    Process *process = (Process *) self;
+    ReadStatus status;
+    local_id from;
+    while ((status = receive_any_non_blocking(process, msg, &from)) == READ_STATUS_EMPTY) {
         sched_yield();
-    } while (empty_exists);
-    return (local_id) -1;
+    }
+    return status == READ_STATUS_OK ? from : (local_id) -1;
+}
+
+static int channel_send(Process *process, local_id dst, const Message *msg) {
+    uint64_t start_ns = trace_enabled() ? monotonic_ns() : 0;
+    msgtrace_record(process->id, dst, msg);
+    if (channel_write(&process->channels[dst], msg) != 0) {
+        return -1;
+    }
+    trace_message(TRACE_SEND, dst, msg, start_ns);
+    return 0;
 }
 
 int send(void *self, local_id dst, const Message *msg) {
@@ -172,7 +240,7 @@ int send(void *self, local_id dst, const Message *msg) {
         return -1;
     }
 
-    return channel_write(&process->channels[dst], msg);
+    return channel_send(process, dst, msg);
 }
 
 int send_multicast(void *self, const Message *msg) {
@@ -185,8 +253,7 @@ int send_multicast(void *self, const Message *msg) {
         if (process->id == dst) {
             continue;
         }
-        Channel *channel = &process->channels[dst];
-        if (channel_write(channel, msg) != 0) {
+        if (channel_send(process, dst, msg) != 0) {
             return -1;
         }
     }
@@ -252,6 +319,7 @@ static Channel *extract_channels(pipe_desc *pipes_matrix, size_t n, size_t x) {
         pipe_desc *write_pipe = matrix_get(pipes_matrix, n, x, i);
         pipe_desc *read_pipe = matrix_get(pipes_matrix, n, i, x);
         channels[i] = (Channel) {
+                .peer = (local_id) i,
                 .rfd = read_pipe->data[0],
                 .wfd = write_pipe->data[1]
         };
@@ -272,9 +340,21 @@ static Channel *extract_channels(pipe_desc *pipes_matrix, size_t n, size_t x) {
     return channels;
 }
 
+static void print_channel_stats(local_id peer, const ChannelStats *stats) {
+    fprintf(pipes_log_fd, "channel process=%d peer=%d sent_messages=%u sent_bytes=%lu received_messages=%u "
+                          "received_bytes=%lu reads=%u writes=%u read_eagain=%u write_eagain=%u partial_reads=%u "
+                          "blocked_us=%lu\n",
+            current_id, peer, stats->sent_messages, (unsigned long) stats->sent_bytes, stats->received_messages,
+            (unsigned long) stats->received_bytes, stats->reads, stats->writes, stats->read_eagain,
+            stats->write_eagain, stats->partial_reads, (unsigned long) (stats->blocked_ns / 1000));
+}
+
 static void free_channels(Channel *channels, local_id channels_size) {
     for (local_id i = 0; i < channels_size; i++) {
         Channel *channel = &channels[i];
+        if (i != current_id) {
+            print_channel_stats(i, &channel->stats);
+        }
         if (channel->rfd != -1) {
             fprintf(pipes_log_fd, "Closed rfd [%d: %d]\n", current_id, i);
             close(channel->rfd);
@@ -287,7 +367,10 @@ static void free_channels(Channel *channels, local_id channels_size) {
     free(channels);
 }
 
-static int run_child_process(local_id id, local_id n, pipe_desc *matrix, process_handler child_handler) {
+static int run_child_process(
+        local_id id, local_id n, pipe_desc *matrix, process_handler child_handler, const MutexOps *mutex,
+        uint8_t tree_arity
+) {
     pid_t pid = fork();
     if (pid == -1) {
         free(matrix);
@@ -300,6 +383,9 @@ static int run_child_process(local_id id, local_id n, pipe_desc *matrix, process
 
     // child code
     current_id = id;
+    if (msgtrace_open(id) != 0) {
+        exit(EXIT_FAILURE);
+    }
     Channel *channels = extract_channels(matrix, n, id);
     free(matrix);
     if (channels == NULL) {
@@ -311,15 +397,17 @@ static int run_child_process(local_id id, local_id n, pipe_desc *matrix, process
             .channels = channels,
             .channels_size = n,
             .id = id,
-            .done_count = 0
+            .mutex = mutex,
+            .tree_arity = tree_arity
     };
-    for (int i = 0; i < DEFERRED_MAX_SIZE; i++) {
-        cps.deferred[i] = false;
-    }
+    barrier_init(&cps.done, DONE);
+    mutex->init(&cps);
 
     if (child_handler(&cps) != 0) {
         printf("Child handler error \n");
     }
+    trace_flush();
+    msgtrace_close();
 
     free_channels(channels, n);
     fclose(pipes_log_fd);
@@ -327,7 +415,11 @@ static int run_child_process(local_id id, local_id n, pipe_desc *matrix, process
     exit(EXIT_SUCCESS);
 }
 
-int run_processes(local_id n, process_handler parent_handler, process_handler child_handler) {
+int run_processes(local_id n, process_handler parent_handler, process_handler child_handler, const MutexOps *mutex,
+                  uint8_t tree_arity) {
+    if (latency_open(n) != 0) {
+        return -1;
+    }
     pipe_desc *matrix = open_pipes(n);
     if (matrix == NULL) {
         perror("malloc");
@@ -335,7 +427,7 @@ int run_processes(local_id n, process_handler parent_handler, process_handler ch
     }
 
     for (local_id i = 1; i < n; i++) {
-        if (run_child_process(i, n, matrix, child_handler) != 0) {
+        if (run_child_process(i, n, matrix, child_handler, mutex, tree_arity) != 0) {
             return -1;
         }
     }
@@ -353,13 +445,22 @@ int run_processes(local_id n, process_handler parent_handler, process_handler ch
             .channels = channels,
             .channels_size = n
     };
+    barrier_init(&parent_process.done, DONE);
 
-    parent_handler(&parent_process);
+    if (msgtrace_open(PARENT_ID) != 0) {
+        free_channels(channels, n);
+        return -1;
+    }
+    int result = parent_handler(&parent_process);
+    msgtrace_close();
 
     free_channels(channels, n);
 
     while (wait(NULL) > 0);
-    return 0;
+    trace_close();
+    latency_print(stderr);
+    latency_close();
+    return result;
 }
 
 timestamp_t get_lamport_time(void) {
@@ -380,91 +481,418 @@ int send_cs_multicast(Process* self, const MessageType type) {
         if (self->id == dst) {
             continue;
         }
-        Channel *channel = &self->channels[dst];
-        if (channel_write(channel, &msg) != 0) {
+        if (channel_send(self, dst, &msg) != 0) {
             return -1;
         }
+        self->stats.messages_sent++;
     }
     return 0;
 }
 
-int send_cs(Process* self, const local_id dst, const MessageType type) {
+int send_cs_payload(Process* self, const local_id dst, const MessageType type, const void *payload, uint16_t payload_len) {
     Message msg = (Message) {
         .s_header = (MessageHeader) {
             .s_magic = MESSAGE_MAGIC,
             .s_local_time = get_lamport_time(),
-            .s_payload_len = 0,
+            .s_payload_len = payload_len,
             .s_type = type
         }
     };
+    if (payload_len > 0) {
+        memcpy(msg.s_payload, payload, payload_len);
+    }
+    self->stats.messages_sent++;
     return send(self, dst, &msg);
 }
 
-static local_id repliers_count(Process *self) {
-    return self->channels_size - 2;
+int send_cs(Process* self, const local_id dst, const MessageType type) {
+    return send_cs_payload(self, dst, type, NULL, 0);
 }
 
-static bool self_after_msg(Process *self, Message* msg, local_id src_id) {
-    if (self->request_time == msg->s_header.s_local_time) {
-        return self->id > src_id;
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Enter every pending lock the mutex allows and call its ready callback. */
+static void enter_ready_locks(Process *self) {
+    for (lock_id lock = 0; lock < MAX_LOCKS; lock++) {
+        PendingLock *pending = &self->pending[lock];
+        if (!pending->active || !self->mutex->try_enter(self, lock)) {
+            continue;
+        }
+        pending->active = false;
+        uint64_t wait_ns = monotonic_ns() - pending->start_ns;
+        self->stats.wait_ns += wait_ns;
+        self->stats.max_wait_ns = MAX(self->stats.max_wait_ns, wait_ns);
+        latency_record(LATENCY_REQUEST_CS, wait_ns);
+        trace_span(TRACE_WAIT, lock, pending->start_ns);
+        trace_begin(TRACE_CS, lock);
+        if (pending->ready != NULL) {
+            pending->ready(self, lock, pending->arg);
+        }
+    }
+}
+
+int request_lock_async(const void *ptr, lock_id lock, LockMode mode, cs_ready_callback ready, void *arg) {
+    Process *self = (Process *) ptr;
+    bool extended = lock != DEFAULT_LOCK || mode != LOCK_WRITE;
+    if (lock >= MAX_LOCKS || (!self->mutex->named_locks && extended)) {
+        fprintf(stderr, "Mutex %s has no lock %d\n", self->mutex->name, lock);
+        return -1;
+    }
+    if (self->pending[lock].active) {
+        fprintf(stderr, "Lock %d is already requested\n", lock);
+        return -1;
+    }
+    self->stats.cs_count++;
+    self->pending[lock] = (PendingLock) {
+            .active = true,
+            .ready = ready,
+            .arg = arg,
+            .start_ns = monotonic_ns()
+    };
+    if (self->mutex->request(self, lock, mode) != 0) {
+        self->pending[lock].active = false;
+        return -1;
     }
-    return self->request_time > msg->s_header.s_local_time;
+    enter_ready_locks(self);
+    return 0;
+}
+
+/** Saturates, UINT64_MAX is no deadline. */
+static uint64_t deadline_after(uint64_t timeout_ns) {
+    uint64_t now_ns = monotonic_ns();
+    return timeout_ns > UINT64_MAX - now_ns ? UINT64_MAX : now_ns + timeout_ns;
+}
+
+int request_lock_timeout(const void *ptr, lock_id lock, LockMode mode, uint64_t timeout_ns) {
+    Process *self = (Process *) ptr;
+    if (self->mutex->withdraw == NULL) {
+        fprintf(stderr, "Mutex %s can't withdraw a request\n", self->mutex->name);
+        return -1;
+    }
+    if (request_lock_async(self, lock, mode, NULL, NULL) != 0) {
+        return -1;
+    }
+    // sending the requests doesn't eat into the wait
+    uint64_t deadline_ns = deadline_after(timeout_ns);
+    while (self->pending[lock].active) {
+        int handled = cs_poll(self);
+        if (handled < 0) {
+            return -1;
+        } else if (handled > 0) {
+            continue;
+        } else if (monotonic_ns() < deadline_ns) {
+            sched_yield();
+            continue;
+        }
+        self->pending[lock].active = false;
+        self->stats.cs_count--;
+        self->stats.withdrawn++;
+        return self->mutex->withdraw(self, lock) == 0 ? 1 : -1;
+    }
+    return 0;
+}
+
+int request_cs_timeout(const void *self, uint64_t timeout_ns) {
+    return request_lock_timeout(self, DEFAULT_LOCK, LOCK_WRITE, timeout_ns);
+}
+
+int try_request_cs(const void *self) {
+    return request_cs_timeout(self, 0);
+}
+
+int request_cs_async(const void *self, cs_ready_callback ready, void *arg) {
+    return request_lock_async(self, DEFAULT_LOCK, LOCK_WRITE, ready, arg);
+}
+
+int request_lock(const void *ptr, lock_id lock) {
+    return request_lock_mode(ptr, lock, LOCK_WRITE);
+}
+
+int request_lock_mode(const void *ptr, lock_id lock, LockMode mode) {
+    Process *self = (Process *) ptr;
+    if (request_lock_async(self, lock, mode, NULL, NULL) != 0) {
+        return -1;
+    }
+    while (self->pending[lock].active) {
+        if (cs_receive_and_handle(self) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int release_lock(const void *ptr, lock_id lock) {
+    Process *self = (Process *) ptr;
+    if (lock >= MAX_LOCKS || (!self->mutex->named_locks && lock != DEFAULT_LOCK)) {
+        fprintf(stderr, "Mutex %s has no lock %d\n", self->mutex->name, lock);
+        return -1;
+    }
+    trace_end(TRACE_CS, lock);
+    return self->mutex->release(self, lock);
 }
 
 int request_cs(const void *ptr) {
+    return request_lock(ptr, DEFAULT_LOCK);
+}
+
+int release_cs(const void *ptr) {
+    return release_lock(ptr, DEFAULT_LOCK);
+}
+
+int request_cs_for(const void *ptr, int ops) {
+    if (ops <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (request_cs(ptr) != 0) {
+        return -1;
+    }
+    return MIN(ops, MAX_CS_BATCH);
+}
+
+int cs_contended(const void *ptr) {
     Process *self = (Process *) ptr;
+    int polled;
+    while ((polled = cs_poll(self)) > 0) {
+    }
+    if (polled < 0) {
+        return -1;
+    }
+    return self->mutex->contended(self, DEFAULT_LOCK) ? 1 : 0;
+}
 
-    local_time++;
-    self->request_time = get_lamport_time();
-    if (send_cs_multicast(self, CS_REQUEST) != 0) {
+static int cs_handle(Process *self, local_id from, const Message *msg) {
+    if (msg->s_header.s_type == DONE) {
+        return barrier_handle(self, &self->done, from, msg);
+    }
+    if (self->mutex->handle(self, from, msg) != 0) {
         return -1;
     }
+    enter_ready_locks(self);
+    return 0;
+}
 
-    local_id reply_count = 0;
-    while (reply_count != repliers_count(self)) {
-        Message msg;
-        local_id id = receive_any(self, &msg);
-        if (id == -1) {
+int cs_receive_and_handle(Process *self) {
+    Message msg;
+    local_id id = receive_any(self, &msg);
+    if (id == -1) {
+        return -1;
+    }
+    return cs_handle(self, id, &msg);
+}
+
+int cs_poll(Process *self) {
+    Message msg;
+    local_id from;
+    switch (receive_any_non_blocking(self, &msg, &from)) {
+        case READ_STATUS_OK:
+            return cs_handle(self, from, &msg) == 0 ? 1 : -1;
+        case READ_STATUS_EMPTY:
+            return 0;
+        default:
             return -1;
+    }
+}
+
+/**
+ * Ricart-Agrawala with Roucairol-Carvalho optimization: permission received
+ * from a peer stays valid until the peer asks for it back, so a process
+ * re-entering the CS requests only from peers that asked since its last entry.
+ * Every lock runs the protocol independently. Readers don't conflict and
+ * reply to each other at once with a shared grant that nobody may reuse, so
+ * a later writer has to ask both of them; any pair with a writer is ordered
+ * by timestamp.
+ */
+static bool self_after(Process *self, const Lock *lock, timestamp_t time, local_id src_id) {
+    if (lock->request_time == time) {
+        return self->id > src_id;
+    }
+    return lock->request_time > time;
+}
+
+static bool ra_permitted_all(Process *self, const Lock *lock) {
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        if (id != self->id && !lock->permitted[id] && !lock->granted[id]) {
+            return false;
         }
-        if (msg.s_header.s_type == CS_REPLY) {
-            reply_count++;
-        } else if (msg.s_header.s_type == DONE) {
-            self->done_count++;
-        } else if (msg.s_header.s_type == CS_REQUEST) {
-            if (self_after_msg(self, &msg, id)) {
-                local_time++;
-                if (send_cs(self, id, CS_REPLY) != 0) {
-                    return -1;
-                }
-            } else {
-                self->deferred[id] = true;
-            }
+    }
+    return true;
+}
+
+static int ra_send_request(Process *self, local_id dst, lock_id lock) {
+    LockRequest request = {
+            .s_lock = lock,
+            .s_mode = self->locks[lock].mode,
+            .s_time = self->locks[lock].request_time
+    };
+    self->locks[lock].asked[dst] = true;
+    local_time++;
+    return send_cs_payload(self, dst, CS_REQUEST, &request, sizeof(request));
+}
+
+static int ra_send_reply(Process *self, local_id dst, lock_id lock, bool shared, timestamp_t time) {
+    LockReply reply = {.s_lock = lock, .s_shared = shared, .s_time = time};
+    local_time++;
+    return send_cs_payload(self, dst, CS_REPLY, &reply, sizeof(reply));
+}
+
+static void ra_init(void *ptr) {
+    Process *self = (Process *) ptr;
+    for (lock_id i = 0; i < MAX_LOCKS; i++) {
+        self->locks[i] = (Lock) {.request_time = EMPTY_REQUEST_TIME, .in_cs = false};
+        for (local_id id = 0; id < DEFERRED_MAX_SIZE; id++) {
+            self->locks[i].deferred[id] = EMPTY_REQUEST_TIME;
+        }
+    }
+}
+
+static int ra_handle(void *ptr, local_id id, const Message *msg) {
+    Process *self = (Process *) ptr;
+    lock_id index = msg->s_payload[0];
+    if (msg->s_header.s_payload_len == 0 || index >= MAX_LOCKS) {
+        return -1;
+    }
+    Lock *lock = &self->locks[index];
+
+    if (msg->s_header.s_type == CS_REPLY) {
+        LockReply reply;
+        memcpy(&reply, msg->s_payload, sizeof(reply));
+        if (reply.s_time != lock->request_time) {
+            // answers a withdrawn request, we may have handed the permission back meanwhile
+            return 0;
+        } else if (reply.s_shared) {
+            lock->granted[id] = true;
         } else {
-            return -1;
+            lock->permitted[id] = true;
         }
+        return 0;
+    } else if (msg->s_header.s_type != CS_REQUEST) {
+        return -1;
+    }
+
+    LockRequest request;
+    memcpy(&request, msg->s_payload, sizeof(request));
+    bool requesting = lock->request_time != EMPTY_REQUEST_TIME;
+    bool conflict = lock->mode == LOCK_WRITE || request.s_mode == LOCK_WRITE;
+    if (conflict && (lock->in_cs || (requesting && !self_after(self, lock, request.s_time, id)))) {
+        lock->deferred[id] = request.s_time;
+        return 0;
     }
 
+    // both read or peer wins, give the permission away and ask it back if it was used
+    bool shared = requesting && !conflict;
+    bool consented = lock->permitted[id] || (!shared && lock->granted[id]);
+    lock->permitted[id] = false;
+    if (!shared) {
+        lock->granted[id] = false;
+    }
+    if (ra_send_reply(self, id, index, shared, request.s_time) != 0) {
+        return -1;
+    }
+    if (requesting && !lock->in_cs && consented && !lock->granted[id]) {
+        return ra_send_request(self, id, index);
+    }
     return 0;
 }
 
-int release_cs(const void * ptr) {
+static int ra_request(void *ptr, lock_id index, LockMode mode) {
     Process *self = (Process *) ptr;
+    Lock *lock = &self->locks[index];
 
-    if (self->request_time == EMPTY_REQUEST_TIME) {
-        fprintf(stderr, "Process is not mutex owner");
-        exit(EXIT_FAILURE);
+    local_time++;
+    lock->mode = mode;
+    lock->request_time = get_lamport_time();
+    memset(lock->granted, 0, sizeof(lock->granted));
+    memset(lock->asked, 0, sizeof(lock->asked));
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        if (id == self->id) {
+            continue;
+        }
+        if (!lock->permitted[id] && ra_send_request(self, id, index) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool ra_try_enter(void *ptr, lock_id index) {
+    Process *self = (Process *) ptr;
+    Lock *lock = &self->locks[index];
+    if (lock->request_time == EMPTY_REQUEST_TIME || lock->in_cs || !ra_permitted_all(self, lock)) {
+        return false;
+    }
+    lock->in_cs = true;
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        self->stats.permissions_reused += id != self->id && !lock->asked[id];
     }
+    return true;
+}
 
-    self->request_time = EMPTY_REQUEST_TIME;
-    local_time++;
+static void ra_reply_deferred(Process *self, lock_id index) {
+    Lock *lock = &self->locks[index];
     for (local_id id = 0; id < self->channels_size; id++) {
-        if (self->deferred[id]) {
-            send_cs(self, id, CS_REPLY);
-            self->deferred[id] = false;
+        if (lock->deferred[id] != EMPTY_REQUEST_TIME) {
+            ra_send_reply(self, id, index, false, lock->deferred[id]);
+            lock->deferred[id] = EMPTY_REQUEST_TIME;
+            lock->permitted[id] = false;
         }
     }
+}
+
+static int ra_release(void *ptr, lock_id index) {
+    Process *self = (Process *) ptr;
+    Lock *lock = &self->locks[index];
+
+    if (!lock->in_cs) {
+        fprintf(stderr, "Process is not mutex owner");
+        exit(EXIT_FAILURE);
+    }
+
+    lock->in_cs = false;
+    lock->request_time = EMPTY_REQUEST_TIME;
+    ra_reply_deferred(self, index);
 
     fflush(stdout);
     return 0;
 }
+
+/** A peer waits for the lock when its request is deferred. */
+static bool ra_contended(void *ptr, lock_id index) {
+    Process *self = (Process *) ptr;
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        if (self->locks[index].deferred[id] != EMPTY_REQUEST_TIME) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Give up a request that hasn't entered. Replies still on the way carry its
+ * time and are dropped, so a permission is never held by both peers.
+ */
+static int ra_withdraw(void *ptr, lock_id index) {
+    Process *self = (Process *) ptr;
+    Lock *lock = &self->locks[index];
+
+    lock->request_time = EMPTY_REQUEST_TIME;
+    memset(lock->granted, 0, sizeof(lock->granted));
+    ra_reply_deferred(self, index);
+    return 0;
+}
+
+const MutexOps ricart_agrawala_mutex = {
+        .name = "ra",
+        .named_locks = true,
+        .init = ra_init,
+        .request = ra_request,
+        .try_enter = ra_try_enter,
+        .release = ra_release,
+        .withdraw = ra_withdraw,
+        .contended = ra_contended,
+        .handle = ra_handle
+};
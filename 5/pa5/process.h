@@ -7,33 +7,136 @@
 
 #include "ipc.h"
 #include "banking.h"
+#include "barrier.h"
+#include "mutex.h"
+#include "cs_batch.h"
+#include "suzuki_kasami.h"
+#include "maekawa.h"
+#include "raymond.h"
 
 enum {
     DEFERRED_MAX_SIZE = MAX_PROCESS_ID + 1,
-    EMPTY_REQUEST_TIME = MAX_T + 1,
+    EMPTY_REQUEST_TIME = -1,
     FIRST_CHILD_ID = 1
 };
 
+/** Transport counters of one peer, written to the pipes log by free_channels. */
 typedef struct {
+    uint32_t sent_messages;
+    uint64_t sent_bytes;
+    uint32_t received_messages;
+    uint64_t received_bytes;
+    uint32_t reads;         ///< read syscalls, empty polls included
+    uint32_t writes;        ///< write syscalls
+    uint32_t read_eagain;
+    uint32_t write_eagain;
+    uint32_t partial_reads; ///< read returned less than asked
+    uint64_t blocked_ns;    ///< spinning on EAGAIN inside a blocking read or write
+} ChannelStats;
+
+typedef struct {
+    local_id peer;
     int rfd;
     int wfd;
+    ChannelStats stats;
 } Channel;
 
+/** Ricart-Agrawala state of one named lock. */
+typedef struct {
+    timestamp_t request_time;
+    LockMode mode;
+    bool in_cs;
+    timestamp_t deferred[DEFERRED_MAX_SIZE]; ///< time of the request to answer on release
+    bool permitted[DEFERRED_MAX_SIZE]; ///< reusable until the peer asks back
+    bool granted[DEFERRED_MAX_SIZE];   ///< shared by a reader for the current request only
+    bool asked[DEFERRED_MAX_SIZE];     ///< sent CS_REQUEST for the current request
+} Lock;
+
+/** CS_REQUEST payload of Ricart-Agrawala. */
+typedef struct {
+    lock_id s_lock;
+    uint8_t s_mode;
+    timestamp_t s_time;
+} __attribute__((packed)) LockRequest;
+
+/** CS_REPLY payload of Ricart-Agrawala. */
+typedef struct {
+    lock_id s_lock;
+    uint8_t s_shared;   ///< reader to reader grant, not reusable
+    timestamp_t s_time; ///< of the request this answers
+} __attribute__((packed)) LockReply;
+
+/** Called once a lock requested with request_lock_async is entered. */
+typedef void (*cs_ready_callback)(void *self, lock_id lock, void *arg);
+
+typedef struct {
+    bool active;
+    cs_ready_callback ready;
+    void *arg;
+    uint64_t start_ns;
+} PendingLock;
+
 typedef struct {
     local_id id;
     local_id channels_size;
     Channel *channels;
-    bool deferred[DEFERRED_MAX_SIZE];
-    local_id done_count;
-    timestamp_t request_time;
+    Barrier done;            ///< DONE of the children, counted by cs_receive_and_handle
+    Lock locks[MAX_LOCKS];
+    PendingLock pending[MAX_LOCKS];
+    SuzukiKasami sk;
+    Maekawa mk;
+    Raymond raymond;
+    uint8_t tree_arity;
+    const MutexOps *mutex;
+    MutexStats stats;
 } Process;
 
 typedef int (*process_handler)(Process *);
 
-int run_processes(local_id n, process_handler parent_handler, process_handler child_handler);
+extern const MutexOps ricart_agrawala_mutex;
+
+int run_processes(local_id n, process_handler parent_handler, process_handler child_handler, const MutexOps *mutex,
+                  uint8_t tree_arity);
 
 int send_cs_multicast(Process* self, MessageType type);
 
 int send_cs(Process* self, local_id dst, MessageType type);
 
+int send_cs_payload(Process* self, local_id dst, MessageType type, const void *payload, uint16_t payload_len);
+
+/** Named lock versions of request_cs and release_cs, request_lock is exclusive. */
+int request_lock(const void *self, lock_id lock);
+
+int request_lock_mode(const void *self, lock_id lock, LockMode mode);
+
+int release_lock(const void *self, lock_id lock);
+
+uint64_t monotonic_ns(void);
+
+/**
+ * Wait for the lock up to timeout_ns after the requests are sent. Returns 0
+ * when entered, 1 when the request was withdrawn at the deadline, -1 on
+ * error. Needs a mutex with withdraw.
+ */
+int request_lock_timeout(const void *self, lock_id lock, LockMode mode, uint64_t timeout_ns);
+
+int request_cs_timeout(const void *self, uint64_t timeout_ns);
+
+/** Handle what has already arrived and withdraw unless the CS can be entered. */
+int try_request_cs(const void *self);
+
+/**
+ * Send the requests and return at once, ready is called from cs_poll or
+ * cs_receive_and_handle (or right here) when the lock is entered.
+ */
+int request_lock_async(const void *self, lock_id lock, LockMode mode, cs_ready_callback ready, void *arg);
+
+int request_cs_async(const void *self, cs_ready_callback ready, void *arg);
+
+/** Receive one message, pass DONE to the barrier or the rest to the mutex handler. */
+int cs_receive_and_handle(Process *self);
+
+/** cs_receive_and_handle without waiting, returns 1 if a message was handled, 0 if none. */
+int cs_poll(Process *self);
+
 #endif //PROGRAM_PROCESS_H
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "process.h"
+#include "raymond.h"
+
+extern timestamp_t local_time;
+
+static local_id tree_parent(local_id id, uint8_t arity) {
+    return (local_id) ((id - FIRST_CHILD_ID - 1) / arity + FIRST_CHILD_ID);
+}
+
+static int send_raymond(Process *self, local_id dst, MessageType type) {
+    local_time++;
+    return send_cs(self, dst, type);
+}
+
+static int assign_privilege(Process *self) {
+    Raymond *r = &self->raymond;
+    if (r->holder != self->id || r->in_cs || r->queue_len == 0) {
+        return 0;
+    }
+    local_id next = r->queue[0];
+    r->queue_len--;
+    memmove(&r->queue[0], &r->queue[1], r->queue_len * sizeof(local_id));
+    r->asked = false;
+    if (next == self->id) {
+        r->in_cs = true;
+        return 0;
+    }
+    r->holder = next;
+    return send_raymond(self, next, CS_PRIVILEGE);
+}
+
+static int make_request(Process *self) {
+    Raymond *r = &self->raymond;
+    if (r->holder == self->id || r->queue_len == 0 || r->asked) {
+        return 0;
+    }
+    r->asked = true;
+    return send_raymond(self, r->holder, CS_REQUEST);
+}
+
+static int advance(Process *self) {
+    if (assign_privilege(self) != 0) {
+        return -1;
+    }
+    return make_request(self);
+}
+
+static void raymond_init(void *ptr) {
+    Process *self = (Process *) ptr;
+    self->raymond = (Raymond) {
+            .holder = self->id == RAYMOND_ROOT ? self->id : tree_parent(self->id, self->tree_arity),
+            .asked = false,
+            .in_cs = false,
+            .queue_len = 0
+    };
+}
+
+static int raymond_handle(void *ptr, local_id from, const Message *msg) {
+    Process *self = (Process *) ptr;
+    Raymond *r = &self->raymond;
+    if (msg->s_header.s_type == CS_REQUEST) {
+        r->queue[r->queue_len++] = from;
+    } else if (msg->s_header.s_type == CS_PRIVILEGE) {
+        r->holder = self->id;
+    } else {
+        return -1;
+    }
+    return advance(self);
+}
+
+static int raymond_request(void *ptr, lock_id lock, LockMode mode) {
+    Process *self = (Process *) ptr;
+    Raymond *r = &self->raymond;
+
+    r->queue[r->queue_len++] = self->id;
+    return advance(self);
+}
+
+/** assign_privilege enters the CS as soon as the token and the queue allow. */
+static bool raymond_try_enter(void *ptr, lock_id lock) {
+    Process *self = (Process *) ptr;
+    return self->raymond.in_cs;
+}
+
+static int raymond_release(void *ptr, lock_id lock) {
+    Process *self = (Process *) ptr;
+    Raymond *r = &self->raymond;
+
+    if (!r->in_cs) {
+        fprintf(stderr, "Process is not mutex owner");
+        return -1;
+    }
+    r->in_cs = false;
+    return advance(self);
+}
+
+static bool raymond_contended(void *ptr, lock_id lock) {
+    return ((Process *) ptr)->raymond.queue_len > 0;
+}
+
+const MutexOps raymond_mutex = {
+        .name = "rt",
+        .init = raymond_init,
+        .request = raymond_request,
+        .try_enter = raymond_try_enter,
+        .release = raymond_release,
+        .contended = raymond_contended,
+        .handle = raymond_handle
+};
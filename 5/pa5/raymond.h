@@ -0,0 +1,30 @@
+#ifndef PROGRAM_RAYMOND_H
+#define PROGRAM_RAYMOND_H
+
+#include <stdbool.h>
+
+#include "ipc.h"
+#include "mutex.h"
+
+enum {
+    RAYMOND_MAX_SIZE = MAX_PROCESS_ID + 1,
+    RAYMOND_ROOT = 1,         ///< process holding the token at start
+    RAYMOND_DEFAULT_ARITY = 2 ///< binary tree
+};
+
+/**
+ * Children form a static tree rooted at RAYMOND_ROOT, parent of child i is
+ * (i - 2) / arity + 1, so arity 1 is a chain and 2 is a binary tree.
+ * holder points to the neighbour in the direction of the token.
+ */
+typedef struct {
+    local_id holder;
+    bool asked;
+    bool in_cs;
+    uint8_t queue_len;
+    local_id queue[RAYMOND_MAX_SIZE];
+} Raymond;
+
+extern const MutexOps raymond_mutex;
+
+#endif //PROGRAM_RAYMOND_H
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/param.h>
+
+#include "process.h"
+#include "suzuki_kasami.h"
+
+extern timestamp_t local_time;
+
+static bool queue_contains(const SuzukiKasamiToken *token, local_id id) {
+    for (size_t i = 0; i < token->s_queue_len; i++) {
+        if (token->s_queue[i] == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_waiting(const SuzukiKasami *sk, local_id id) {
+    return sk->requests[id] == sk->token.s_last[id] + 1;
+}
+
+static int send_token(Process *self, local_id dst) {
+    SuzukiKasami *sk = &self->sk;
+    sk->has_token = false;
+    local_time++;
+    uint16_t len = offsetof(SuzukiKasamiToken, s_queue) + sk->token.s_queue_len * sizeof(local_id);
+    return send_cs_payload(self, dst, CS_TOKEN, &sk->token, len);
+}
+
+static void sk_init(void *ptr) {
+    Process *self = (Process *) ptr;
+    self->sk = (SuzukiKasami) {
+            .has_token = self->id == SK_TOKEN_HOLDER,
+            .in_cs = false
+    };
+}
+
+static int sk_handle(void *ptr, local_id from, const Message *msg) {
+    Process *self = (Process *) ptr;
+    SuzukiKasami *sk = &self->sk;
+    if (msg->s_header.s_type == CS_REQUEST) {
+        uint16_t number;
+        memcpy(&number, msg->s_payload, sizeof(number));
+        sk->requests[from] = MAX(sk->requests[from], number);
+        if (sk->has_token && !sk->in_cs && is_waiting(sk, from)) {
+            return send_token(self, from);
+        }
+        return 0;
+    } else if (msg->s_header.s_type == CS_TOKEN) {
+        memset(&sk->token, 0, sizeof(SuzukiKasamiToken));
+        memcpy(&sk->token, msg->s_payload, msg->s_header.s_payload_len);
+        sk->has_token = true;
+        return 0;
+    }
+    return -1;
+}
+
+static int sk_request(void *ptr, lock_id lock, LockMode mode) {
+    Process *self = (Process *) ptr;
+    SuzukiKasami *sk = &self->sk;
+
+    if (sk->has_token) {
+        return 0;
+    }
+    uint16_t number = ++sk->requests[self->id];
+    local_time++;
+    for (local_id dst = FIRST_CHILD_ID; dst < self->channels_size; dst++) {
+        if (dst == self->id) {
+            continue;
+        }
+        if (send_cs_payload(self, dst, CS_REQUEST, &number, sizeof(number)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool sk_try_enter(void *ptr, lock_id lock) {
+    Process *self = (Process *) ptr;
+    SuzukiKasami *sk = &self->sk;
+    if (!sk->has_token || sk->in_cs) {
+        return false;
+    }
+    sk->in_cs = true;
+    return true;
+}
+
+static int sk_release(void *ptr, lock_id lock) {
+    Process *self = (Process *) ptr;
+    SuzukiKasami *sk = &self->sk;
+    SuzukiKasamiToken *token = &sk->token;
+
+    if (!sk->in_cs) {
+        fprintf(stderr, "Process is not mutex owner");
+        return -1;
+    }
+    sk->in_cs = false;
+    token->s_last[self->id] = sk->requests[self->id];
+
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        if (id != self->id && is_waiting(sk, id) && !queue_contains(token, id)) {
+            token->s_queue[token->s_queue_len++] = id;
+        }
+    }
+    if (token->s_queue_len == 0) {
+        return 0;
+    }
+
+    local_id next = token->s_queue[0];
+    token->s_queue_len--;
+    memmove(&token->s_queue[0], &token->s_queue[1], token->s_queue_len * sizeof(local_id));
+    return send_token(self, next);
+}
+
+static bool sk_contended(void *ptr, lock_id lock) {
+    Process *self = (Process *) ptr;
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        if (id != self->id && is_waiting(&self->sk, id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const MutexOps suzuki_kasami_mutex = {
+        .name = "sk",
+        .init = sk_init,
+        .request = sk_request,
+        .try_enter = sk_try_enter,
+        .release = sk_release,
+        .contended = sk_contended,
+        .handle = sk_handle
+};
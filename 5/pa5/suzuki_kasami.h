@@ -0,0 +1,33 @@
+#ifndef PROGRAM_SUZUKI_KASAMI_H
+#define PROGRAM_SUZUKI_KASAMI_H
+
+#include <stdbool.h>
+
+#include "ipc.h"
+#include "mutex.h"
+
+enum {
+    SK_MAX_SIZE = MAX_PROCESS_ID + 1,
+    SK_TOKEN_HOLDER = 1 ///< process holding the token at start
+};
+
+/**
+ * Token travels with the number of the last granted request of every process
+ * and the FIFO queue of processes waiting for it.
+ */
+typedef struct {
+    uint16_t s_last[SK_MAX_SIZE];
+    uint8_t  s_queue_len;
+    local_id s_queue[SK_MAX_SIZE];
+} __attribute__((packed)) SuzukiKasamiToken;
+
+typedef struct {
+    uint16_t requests[SK_MAX_SIZE];
+    bool has_token;
+    bool in_cs;
+    SuzukiKasamiToken token;
+} SuzukiKasami;
+
+extern const MutexOps suzuki_kasami_mutex;
+
+#endif //PROGRAM_SUZUKI_KASAMI_H
@@ -0,0 +1,61 @@
+#ifndef PROGRAM_TRACE_H
+#define PROGRAM_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ipc.h"
+
+static const char * const trace_json = "trace.json";
+
+enum {
+    TRACE_CAPACITY = 1 << 16 ///< events per process, later ones are dropped
+};
+
+typedef enum {
+    TRACE_SEND = 0, ///< channel_write, flow starts here
+    TRACE_RECEIVE,  ///< read of a whole message, flow ends here
+    TRACE_WAIT,     ///< from request to entering the CS
+    TRACE_CS        ///< from entering to release
+} TraceKind;
+
+typedef struct {
+    uint8_t kind;
+    char phase;        ///< Chrome phase: X complete, B begin, E end
+    local_id from;
+    local_id to;
+    int16_t arg;       ///< message type or lock
+    timestamp_t lamport;
+    uint32_t seq;      ///< of the message on its channel, pairs send and receive
+    uint64_t start_ns;
+    uint64_t end_ns;
+} TraceEvent;
+
+/**
+ * Events are buffered per process and appended to path as one write at
+ * exit, the parent closes the JSON array last. The result loads in
+ * chrome://tracing or Perfetto, one process per lane, with flow arrows from
+ * every send to its receive. Must be called before fork.
+ */
+int trace_open(const char *path);
+
+bool trace_enabled(void);
+
+/** Message slice from start_ns till now, with the Lamport time of the message. */
+void trace_message(TraceKind kind, local_id peer, const Message *msg, uint64_t start_ns);
+
+/** Slice from start_ns till now at the current Lamport time. */
+void trace_span(TraceKind kind, int16_t arg, uint64_t start_ns);
+
+/** Slices that begin and end in different functions. */
+void trace_begin(TraceKind kind, int16_t arg);
+
+void trace_end(TraceKind kind, int16_t arg);
+
+/** Append events of a child. */
+void trace_flush(void);
+
+/** Append events of the parent and close the array, after wait(). */
+void trace_close(void);
+
+#endif //PROGRAM_TRACE_H
@@ -0,0 +1,253 @@
+/**
+ * Transport microbenchmarks over the pa5 process mesh, one CSV row per
+ * measurement on stdout:
+ *   pingpong     round trip between parent and one child
+ *   throughput   one child streams to the parent, for payloads up to MAX_PAYLOAD_LEN
+ *   multicast    send_multicast from the parent to n children
+ *   receive_any  round trip to one child through receive_any, other channels idle
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "process.h"
+
+FILE *pipes_log_fd;
+FILE *event_log_fd;
+local_id current_id;
+timestamp_t local_time = 0;
+
+typedef enum {
+    BENCH_PINGPONG = 0,
+    BENCH_THROUGHPUT,
+    BENCH_MULTICAST,
+    BENCH_RECEIVE_ANY
+} Benchmark;
+
+static const char *const bench_names[] = {
+        [BENCH_PINGPONG] = "pingpong",
+        [BENCH_THROUGHPUT] = "throughput",
+        [BENCH_MULTICAST] = "multicast",
+        [BENCH_RECEIVE_ANY] = "receive_any"
+};
+
+static const uint16_t payload_sizes[] = {0, 16, 64, 256, 1024, 2048, MAX_PAYLOAD_LEN};
+
+enum {
+    BENCH_WARMUP = 100
+};
+
+static struct {
+    int iterations;
+    local_id max_children;
+    Benchmark benchmark; ///< of the current run_processes, read by children after fork
+} bench = {
+        .iterations = 1000,
+        .max_children = 9
+};
+
+static Message make_message(MessageType type, uint16_t payload_len) {
+    Message msg = (Message) {
+            .s_header = (MessageHeader) {
+                    .s_magic = MESSAGE_MAGIC,
+                    .s_payload_len = payload_len,
+                    .s_type = type,
+                    .s_local_time = get_lamport_time()
+            }
+    };
+    memset(msg.s_payload, 0xab, payload_len);
+    return msg;
+}
+
+static void print_row(local_id n, uint16_t payload, int ops, uint64_t total_ns) {
+    double seconds = total_ns / 1e9;
+    printf("%s,%d,%d,%d,%lu,%.1f,%.1f,%.3f\n", bench_names[bench.benchmark], n, payload, ops,
+           (unsigned long) total_ns, (double) total_ns / ops, ops / seconds,
+           (double) ops * (sizeof(MessageHeader) + payload) / seconds / 1e6);
+    fflush(stdout);
+}
+
+/** Echo everything from the parent until STOP. */
+static int child_echo(Process *self) {
+    Message msg;
+    while (receive(self, PARENT_ID, &msg) == 0 && msg.s_header.s_type != STOP) {
+        if (send(self, PARENT_ID, &msg) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/** Every TRANSFER from the parent asks for iterations messages of its payload size. */
+static int child_stream(Process *self) {
+    Message msg;
+    while (receive(self, PARENT_ID, &msg) == 0 && msg.s_header.s_type != STOP) {
+        uint16_t payload_len;
+        memcpy(&payload_len, msg.s_payload, sizeof(payload_len));
+        Message data = make_message(STARTED, payload_len);
+        for (int i = 0; i < bench.iterations; i++) {
+            if (send(self, PARENT_ID, &data) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/** Drain the multicasts and confirm with ACK. */
+static int child_drain(Process *self) {
+    Message msg;
+    for (int i = 0; i < BENCH_WARMUP + bench.iterations; i++) {
+        if (receive(self, PARENT_ID, &msg) != 0) {
+            return -1;
+        }
+    }
+    Message ack = make_message(ACK, 0);
+    return send(self, PARENT_ID, &ack);
+}
+
+static int child_run(Process *self) {
+    switch (bench.benchmark) {
+        case BENCH_THROUGHPUT:
+            return child_stream(self);
+        case BENCH_MULTICAST:
+            return child_drain(self);
+        case BENCH_RECEIVE_ANY:
+            if (self->id != FIRST_CHILD_ID) {
+                // idle until STOP, yielding the CPU between passes
+                Message msg;
+                return receive_any(self, &msg) == PARENT_ID ? 0 : -1;
+            }
+            return child_echo(self);
+        default:
+            return child_echo(self);
+    }
+}
+
+static int stop_children(Process *self) {
+    Message stop = make_message(STOP, 0);
+    return send_multicast(self, &stop);
+}
+
+static int parent_pingpong(Process *self) {
+    Message msg = make_message(STARTED, 0);
+    uint64_t start_ns = 0;
+    for (int i = 0; i < BENCH_WARMUP + bench.iterations; i++) {
+        if (i == BENCH_WARMUP) {
+            start_ns = monotonic_ns();
+        }
+        bool any = bench.benchmark == BENCH_RECEIVE_ANY;
+        if (send(self, FIRST_CHILD_ID, &msg) != 0
+            || (any ? receive_any(self, &msg) != FIRST_CHILD_ID : receive(self, FIRST_CHILD_ID, &msg) != 0)) {
+            return -1;
+        }
+    }
+    print_row(self->channels_size - 1, 0, bench.iterations, monotonic_ns() - start_ns);
+    return stop_children(self);
+}
+
+static int parent_throughput(Process *self) {
+    for (size_t i = 0; i < sizeof(payload_sizes) / sizeof(payload_sizes[0]); i++) {
+        Message msg = make_message(TRANSFER, sizeof(uint16_t));
+        memcpy(msg.s_payload, &payload_sizes[i], sizeof(uint16_t));
+        uint64_t start_ns = monotonic_ns();
+        if (send(self, FIRST_CHILD_ID, &msg) != 0) {
+            return -1;
+        }
+        for (int j = 0; j < bench.iterations; j++) {
+            if (receive(self, FIRST_CHILD_ID, &msg) != 0) {
+                return -1;
+            }
+        }
+        print_row(1, payload_sizes[i], bench.iterations, monotonic_ns() - start_ns);
+    }
+    return stop_children(self);
+}
+
+static int parent_multicast(Process *self) {
+    Message msg = make_message(STARTED, 0);
+    uint64_t start_ns = 0;
+    for (int i = 0; i < BENCH_WARMUP + bench.iterations; i++) {
+        if (i == BENCH_WARMUP) {
+            start_ns = monotonic_ns();
+        }
+        if (send_multicast(self, &msg) != 0) {
+            return -1;
+        }
+    }
+    // counts until every child has it, a full pipe stalls the sender anyway
+    for (local_id id = FIRST_CHILD_ID; id < self->channels_size; id++) {
+        if (receive(self, id, &msg) != 0) {
+            return -1;
+        }
+    }
+    print_row(self->channels_size - 1, 0, bench.iterations, monotonic_ns() - start_ns);
+    return 0;
+}
+
+static int parent_run(Process *self) {
+    int result;
+    switch (bench.benchmark) {
+        case BENCH_THROUGHPUT:
+            result = parent_throughput(self);
+            break;
+        case BENCH_MULTICAST:
+            result = parent_multicast(self);
+            break;
+        default:
+            result = parent_pingpong(self);
+            break;
+    }
+    if (result != 0) {
+        fprintf(stderr, "Benchmark %s failed\n", bench_names[bench.benchmark]);
+    }
+    return result;
+}
+
+static int run(Benchmark benchmark, local_id children) {
+    bench.benchmark = benchmark;
+    local_time = 0;
+    // children would flush a copy of anything still buffered
+    fflush(stdout);
+    return run_processes(children + 1, parent_run, child_run, &ricart_agrawala_mutex, RAYMOND_DEFAULT_ARITY);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "i:p:")) != -1) {
+        switch (opt) {
+            case 'i':
+                bench.iterations = atoi(optarg);
+                break;
+            case 'p':
+                bench.max_children = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-i ITERATIONS] [-p MAX_CHILDREN]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (bench.iterations <= 0 || bench.max_children < 1 || bench.max_children > MAX_PROCESS_ID) {
+        fprintf(stderr, "Iterations must be positive, children between 1 and %d\n", MAX_PROCESS_ID);
+        return EXIT_FAILURE;
+    }
+
+    pipes_log_fd = fopen("/dev/null", "w");
+    event_log_fd = fopen("/dev/null", "w");
+    if (pipes_log_fd == NULL || event_log_fd == NULL) {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+    current_id = PARENT_ID;
+
+    printf("benchmark,children,payload,ops,total_ns,ns_per_op,ops_per_s,mb_per_s\n");
+    int result = run(BENCH_PINGPONG, 1) || run(BENCH_THROUGHPUT, 1);
+    for (local_id n = 1; result == 0 && n <= bench.max_children; n++) {
+        result = run(BENCH_MULTICAST, n) || run(BENCH_RECEIVE_ANY, n);
+    }
+
+    fclose(pipes_log_fd);
+    fclose(event_log_fd);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,99 @@
+#!/bin/bash
+# Run the pa3, pa4 and pa5 workloads for a range of child counts, with and
+# without --mutexl, and report how they scale. Raw runs go to a CSV file, a
+# table of means over the repeats to stdout. Messages are the sent_messages of
+# the channel counters in pipes.log, CS/transfer counts come from the latency
+# summary the parent prints at exit with -L/--latency.
+#
+# usage: scaling_bench.sh BUILD_DIR
+# env:   SIZES of -p (default "2 ... 15"), LABS (default "pa3 pa4 pa5"),
+#        REPEAT runs per configuration (default 3), CSV file (default scaling_bench.csv),
+#        RUNTIME_DIR with a libruntime.so to use instead of the prebuilt one of each lab,
+#        e.g. BUILD_DIR/runtime/fast
+
+set -e
+
+repo=$(cd "$(dirname "$0")/.." && pwd)
+if [ $# -ne 1 ]; then
+    echo "usage: $0 BUILD_DIR" >&2
+    exit 2
+fi
+build=$(realpath "$1")
+sizes=${SIZES:-$(seq -s ' ' 2 15)}
+labs=${LABS:-pa3 pa4 pa5}
+repeat=${REPEAT:-3}
+csv=$(realpath "${CSV:-scaling_bench.csv}")
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+cd "$workdir"
+
+# one run: wall and CPU time of the whole process tree, counters from pipes.log and stderr
+run() {
+    local lab=$1 mutex=$2 n=$3 round=$4
+    local number=${lab#pa}
+    local args=(-p "$n")
+    if [ "$lab" = pa3 ]; then
+        args+=(-L)
+        for ((i = 0; i < n; i++)); do
+            args+=(10)
+        done
+    else
+        args+=(--latency)
+        if [ "$mutex" = 1 ]; then
+            args+=(--mutexl)
+        fi
+    fi
+
+    local start end
+    : >pipes.log
+    start=$(date +%s%N)
+    TIMEFORMAT='%3U %3S'
+    { time LD_LIBRARY_PATH="${RUNTIME_DIR:-$repo/$number/$lab/lib64}" "$build/$number/$lab" "${args[@]}" \
+        >/dev/null 2>stderr.txt; } 2>time.txt
+    end=$(date +%s%N)
+
+    read -r user sys <time.txt
+    awk -v lab="$lab" -v mutex="$mutex" -v n="$n" -v round="$round" -v ms=$(((end - start) / 1000000)) \
+        -v user="$user" -v sys="$sys" '
+        FILENAME == "pipes.log" && $1 == "channel" { split($4, field, "="); messages += field[2] }
+        $1 == "latency:" && $3 == "all" && ($4 == "request_cs" || $4 == "transfer") { ops = $6 }
+        END {
+            rate = ms > 0 ? ops * 1000 / ms : 0
+            printf "%s,%d,%d,%d,%d,%d,%d,%d,%d,%.1f\n", lab, mutex, n, round, ms, user * 1000, sys * 1000,
+                   messages, ops, rate
+        }' pipes.log stderr.txt
+}
+
+echo "lab,mutex,n,round,wall_ms,user_ms,sys_ms,messages,ops,ops_per_s" >"$csv"
+for lab in $labs; do
+    mutexes="0 1"
+    if [ "$lab" = pa3 ]; then
+        mutexes=0
+    fi
+    for mutex in $mutexes; do
+        for n in $sizes; do
+            for ((round = 1; round <= repeat; round++)); do
+                run "$lab" "$mutex" "$n" "$round" >>"$csv"
+            done
+        done
+    done
+done
+
+# ops are transfers for pa3 and CS entries with --mutexl
+awk -F, '
+    NR > 1 {
+        key = $1 "," $2 "," $3
+        if (!(key in runs)) order[++keys] = key
+        runs[key]++; wall[key] += $5; cpu[key] += $6 + $7; messages[key] += $8; ops[key] += $9; rate[key] += $10
+    }
+    END {
+        printf "%-4s %5s %3s %10s %10s %10s %8s %10s\n", "lab", "mutex", "n", "wall_ms", "cpu_ms", "messages",
+               "ops", "ops_per_s"
+        for (i = 1; i <= keys; i++) {
+            key = order[i]; split(key, f, ","); r = runs[key]
+            printf "%-4s %5s %3s %10.0f %10.0f %10.0f %8.0f %10.1f\n", f[1], f[2], f[3], wall[key] / r, cpu[key] / r,
+                   messages[key] / r, ops[key] / r, rate[key] / r
+        }
+    }' "$csv"
+echo "raw runs: $csv"
@@ -0,0 +1,309 @@
+/**
+ * Checking build of libruntime.so, equivalent to the prebuilt one: read, write
+ * and fork are interposed to find the pipes carrying messages, every write is
+ * delayed by WRITE_DELAY_US, a sizeof(Message) write kills the process group
+ * and the physical time counts the TRANSFERs sent by the parent.
+ *
+ * PA45_SILENT disables print, PA_STRACE_MODE sleeps after a read that would
+ * block, PA_RT_DEBUG logs every message with vector time to pa_rt_debug.log.
+ */
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "banking.h"
+#include "pa2345.h"
+#include "runtime.h"
+
+static const char *const debug_output = "pa_rt_debug.log";
+
+static struct {
+    ssize_t (*read)(int fd, void *buf, size_t count);
+    ssize_t (*write)(int fd, const void *buf, size_t count);
+    pid_t (*fork)(void);
+    bool silent;
+    bool strace_mode;
+    int log_fd;               ///< 0 unless PA_RT_DEBUG is set
+    int self_id;              ///< order of the fork, the parent is 0
+    time_t time_vector[MAX_PROCS];
+    int32_t *physical_time;   ///< shared
+    int32_t *nids;            ///< shared, processes forked so far
+    int32_t *fd_to_id;        ///< shared, process at the other end of a pipe fd
+    bool has_header;          ///< of received, its payload is read next
+    Message received;
+} runtime;
+
+static void *shared_array(size_t count) {
+    void *array = mmap(NULL, sizeof(int32_t) * count, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (array == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return array;
+}
+
+static void init(void) {
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+    runtime.physical_time = shared_array(1);
+    runtime.nids = shared_array(1);
+    runtime.fd_to_id = shared_array(MAX_FDS);
+    for (int i = 0; i < MAX_FDS; i++) {
+        runtime.fd_to_id[i] = UNKNOWN_FD;
+    }
+
+    runtime.strace_mode = getenv("PA_STRACE_MODE") != NULL;
+    runtime.silent = getenv("PA45_SILENT") != NULL;
+    if (getenv("PA_RT_DEBUG") != NULL) {
+        runtime.log_fd = open(debug_output, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_SYNC, 0644);
+        if (runtime.log_fd == -1) {
+            fprintf(stderr, "Failed to open %s\n", debug_output);
+            exit(1);
+        }
+    }
+
+    // ISO C has no conversion from void * to a function pointer
+    *(void **) &runtime.read = dlsym(RTLD_NEXT, "read");
+    *(void **) &runtime.write = dlsym(RTLD_NEXT, "write");
+    *(void **) &runtime.fork = dlsym(RTLD_NEXT, "fork");
+}
+
+/** Only pipes carry messages, everything else passes through. */
+static bool is_pipe(int fd) {
+    struct stat stat_buffer;
+    if (fstat(fd, &stat_buffer) == -1) {
+        fprintf(stderr, "Failed to stat %d\n", fd);
+        _exit(1);
+    }
+    return S_ISFIFO(stat_buffer.st_mode);
+}
+
+pid_t fork(void) {
+    init();
+    int32_t id = ++*runtime.nids;
+    pid_t pid = runtime.fork();
+    if (pid == 0) {
+        runtime.self_id = id;
+    }
+    return pid;
+}
+
+void fill_header(MessageHeader *header, MessageType type, size_t payload_len) {
+    header->s_type = type;
+    header->s_magic = MESSAGE_MAGIC;
+    header->s_payload_len = payload_len;
+}
+
+static int writex(int fd, const void *buf, size_t count) {
+    if (count > PIPE_BUF) {
+        fprintf(stderr, "writes > PIPE_BUF(%d) are not supported\n", PIPE_BUF);
+        return -1;
+    }
+    ssize_t result;
+    while ((result = runtime.write(fd, buf, count)) == -1 && errno == EAGAIN) {
+        usleep(STRACE_SLEEP_US);
+    }
+    return (int) result;
+}
+
+int send_vtime(int fd) {
+    if (runtime.fd_to_id[fd - 1] == UNKNOWN_FD) {
+        // pipe() hands out the read end just before the write end
+        runtime.fd_to_id[fd - 1] = runtime.self_id;
+    }
+    struct {
+        MessageHeader header;
+        time_t time_vector[MAX_PROCS];
+    } vtime;
+    fill_header(&vtime.header, VECTOR_TIME_RT, sizeof(vtime.time_vector));
+    vtime.header.s_local_time = runtime.self_id;
+    memcpy(vtime.time_vector, runtime.time_vector, sizeof(vtime.time_vector));
+    writex(fd, &vtime, sizeof(vtime));
+    return 0;
+}
+
+int receive_vtime(int fd, const MessageHeader *header) {
+    time_t time_vector[MAX_PROCS];
+    if (header->s_payload_len != sizeof(time_vector)
+        || runtime.read(fd, time_vector, sizeof(time_vector)) != sizeof(time_vector)) {
+        fprintf(stderr, "Failed to receive VTIME_RT!\n");
+        exit(1);
+    }
+    for (int i = 0; i < MAX_PROCS; i++) {
+        if (runtime.time_vector[i] < time_vector[i]) {
+            runtime.time_vector[i] = time_vector[i];
+        }
+    }
+    runtime.time_vector[runtime.self_id]++;
+    return 0;
+}
+
+void print_event_msg(const Message *msg, bool is_received, int another_proc) {
+    init();
+    if (runtime.log_fd == 0) {
+        return;
+    }
+    const MessageHeader *header = &msg->s_header;
+    char buffer[2 * MAX_MESSAGE_LEN];
+    int length = sprintf(buffer, "proc %d: [", runtime.self_id);
+    for (int i = 0; i < *runtime.nids; i++) {
+        length += sprintf(buffer + length, "%ld,", (long) runtime.time_vector[i]);
+    }
+    length += sprintf(buffer + length, "%ld] ", (long) runtime.time_vector[*runtime.nids]);
+    length += sprintf(buffer + length, is_received ? "receive from %d { " : "send to %d { ", another_proc);
+    length += sprintf(buffer + length, "local_time=%d, payload_len=%d, type=%d", header->s_local_time,
+                      header->s_payload_len, header->s_type);
+
+    switch (header->s_type) {
+        case STARTED:
+        case DONE:
+            // the log line of the sender, without its newline
+            length += sprintf(buffer + length, ", '");
+            memcpy(buffer + length, msg->s_payload, header->s_payload_len);
+            length += header->s_payload_len;
+            while (length > 0 && (buffer[length - 1] == '\0' || buffer[length - 1] == '\n')) {
+                length--;
+            }
+            length += sprintf(buffer + length, "'");
+            break;
+        case TRANSFER: {
+            const TransferOrder *order = (const TransferOrder *) msg->s_payload;
+            length += sprintf(buffer + length, ", { src=%d, dst=%d, amount=%d }", order->s_src, order->s_dst,
+                              order->s_amount);
+            break;
+        }
+        case BALANCE_HISTORY: {
+            const BalanceHistory *history = (const BalanceHistory *) msg->s_payload;
+            length += sprintf(buffer + length, ", { id=%d, nchanges=%d }", history->s_id, history->s_history_len);
+            break;
+        }
+        default:
+            break;
+    }
+    length += sprintf(buffer + length, " }\n");
+    runtime.write(runtime.log_fd, buffer, length);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    init();
+    usleep(WRITE_DELAY_US);
+    if (fd <= STDERR_FILENO || buf == NULL || count < sizeof(MessageHeader) || !is_pipe(fd)) {
+        return runtime.write(fd, buf, count);
+    }
+    const MessageHeader *header = buf;
+    if (header->s_magic != MESSAGE_MAGIC) {
+        return runtime.write(fd, buf, count);
+    }
+
+    if (count == sizeof(Message)) {
+        fprintf(stderr, "Unused part of payload buffer should not be send, i.e. don't use 'sizeof(Message)'\n");
+        killpg(0, SIGSEGV);
+    }
+    if (runtime.self_id == PARENT_ID && header->s_type == TRANSFER) {
+        ++*runtime.physical_time;
+    }
+    if (runtime.log_fd != 0) {
+        runtime.time_vector[runtime.self_id]++;
+        send_vtime(fd);
+        print_event_msg(buf, false, runtime.fd_to_id[fd]);
+    }
+    return runtime.write(fd, buf, count);
+}
+
+static ssize_t read_pipe(int fd, void *buf, size_t count) {
+    ssize_t result = runtime.read(fd, buf, count);
+    if (runtime.strace_mode && result == -1 && errno == EAGAIN) {
+        // keeps a polling loop from flooding strace
+        usleep(STRACE_SLEEP_US);
+    }
+    return result;
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+    init();
+    if (fd <= STDERR_FILENO || buf == NULL || count == 0 || !is_pipe(fd)) {
+        return runtime.read(fd, buf, count);
+    }
+    if (runtime.log_fd == 0) {
+        return read_pipe(fd, buf, count);
+    }
+
+    // debug mode expects the header and the payload in separate reads
+    if (runtime.fd_to_id[fd + 1] == UNKNOWN_FD) {
+        runtime.fd_to_id[fd + 1] = runtime.self_id;
+    }
+    ssize_t result;
+    if (count == sizeof(MessageHeader)) {
+        result = read_pipe(fd, buf, count);
+        if (result <= 0) {
+            return result;
+        }
+        if (result != (ssize_t) count) {
+            fprintf(stderr, "Failed to read header from %d\n", fd);
+            exit(1);
+        }
+        const MessageHeader *header = buf;
+        if (header->s_magic != MESSAGE_MAGIC) {
+            fprintf(stderr, "Wrong s_magic: %d from %d, proc %d\n", header->s_magic, fd, runtime.self_id);
+            exit(1);
+        }
+        if (header->s_type == VECTOR_TIME_RT) {
+            receive_vtime(fd, header);
+            return read(fd, buf, count);
+        }
+        runtime.received.s_header = *header;
+        runtime.has_header = true;
+        return result;
+    }
+
+    if (!runtime.has_header) {
+        fprintf(stderr, "Receiving payload from fd=%d (size=%d), but haven't received header yet!\n", fd,
+                (int) count);
+        killpg(0, SIGSEGV);
+    }
+    result = read_pipe(fd, buf, count);
+    if (result <= 0) {
+        return result;
+    }
+    size_t expected = runtime.received.s_header.s_payload_len;
+    if (result != (ssize_t) count || (size_t) result != expected) {
+        fprintf(stderr, "Requested %d, received %d, expected %d\n", (int) count, (int) result, (int) expected);
+        exit(1);
+    }
+    memcpy(runtime.received.s_payload, buf, result);
+    print_event_msg(&runtime.received, true, runtime.fd_to_id[fd]);
+    runtime.has_header = false;
+    return result;
+}
+
+void print(const char *s) {
+    init();
+    if (runtime.silent) {
+        return;
+    }
+    // a character at a time, so that concurrent prints interleave
+    for (; *s != '\0'; s++) {
+        write(STDERR_FILENO, s, 1);
+        usleep(WRITE_DELAY_US);
+    }
+}
+
+timestamp_t get_physical_time() {
+    init();
+    return (timestamp_t) *runtime.physical_time;
+}
@@ -0,0 +1,333 @@
+/**
+ * Critical path of a run from the msgtrace.<id>.bin rings of pa3 -M or
+ * pa5 --msg-trace. Every send and receive is an event, consecutive events of
+ * a process and the k-th send on a channel with its k-th receive are the
+ * edges of the happens-before DAG, the Lamport times of both ends of a
+ * message must agree. An event waits for the later of its predecessors, the
+ * chain of such waits back from the last event of the run is the critical
+ * path, split into message transport and local work of each process. The
+ * slack of an event is how much later it could have happened without
+ * delaying the last event.
+ *
+ * usage: critical_path [-v] msgtrace.*.bin
+ *   -v  print the events of the critical path
+ */
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mutex.h"
+#include "msgtrace_file.h"
+
+typedef struct Event {
+    const MsgTraceRecord *record;
+    local_id process;
+    size_t slot;             ///< index of the process in the arguments
+    bool is_send;
+    double time;             ///< us since the first trace was opened
+    struct Event *prev;      ///< program order
+    struct Event *next;
+    struct Event *match;     ///< the other end of the message, NULL if it wasn't traced
+    double ready;            ///< end of the latest predecessor
+    struct Event *critical;  ///< that predecessor, NULL for the first event of a process
+    double latest;           ///< latest time that doesn't delay the last event
+    bool done;
+    bool on_path;
+} Event;
+
+typedef struct {
+    const TraceFile *file;
+    Event *events;
+    size_t count;
+    size_t next;             ///< forward pass position
+    double start;            ///< us when the trace was opened
+    double path_local;       ///< us of local work on the critical path
+    size_t path_events;
+} Process;
+
+static const char *const type_names[] = {
+        "STARTED", "DONE", "ACK", "STOP", "TRANSFER", "BALANCE_HISTORY", "CS_REQUEST", "CS_REPLY", "CS_RELEASE",
+        "CS_TOKEN", "CS_INQUIRE", "CS_YIELD", "CS_FAILED", "CS_PRIVILEGE"
+};
+
+static const char *type_name(int16_t type, char *buffer) {
+    if (type >= 0 && type < (int16_t) (sizeof(type_names) / sizeof(type_names[0]))) {
+        return type_names[type];
+    }
+    sprintf(buffer, "type %d", type);
+    return buffer;
+}
+
+static double work(const Event *event) {
+    return event->time > event->ready ? event->time - event->ready : 0;
+}
+
+/** Pair the k-th send from -> to with the k-th receive, unmatched sends were still in the pipe. */
+static int match_channel(Process *from, Process *to) {
+    local_id src = from->file->header.process;
+    local_id dst = to->file->header.process;
+    size_t i = 0;
+    size_t j = 0;
+    for (;;) {
+        while (i < from->count && !(from->events[i].is_send && from->events[i].record->dst == dst)) {
+            i++;
+        }
+        while (j < to->count && !(!to->events[j].is_send && to->events[j].record->src == src)) {
+            j++;
+        }
+        if (j == to->count) {
+            return 0;
+        }
+        if (i == from->count) {
+            fprintf(stderr, "%d -> %d: receive at %.3f us has no send\n", src, dst, to->events[j].time);
+            return -1;
+        }
+        Event *send = &from->events[i++];
+        Event *receive = &to->events[j++];
+        if (send->record->lamport != receive->record->lamport || send->record->type != receive->record->type) {
+            fprintf(stderr, "%d -> %d: send at %.3f us with local_time=%d doesn't match receive with local_time=%d\n",
+                    src, dst, send->time, send->record->lamport, receive->record->lamport);
+            return -1;
+        }
+        send->match = receive;
+        receive->match = send;
+    }
+}
+
+/** Ready time and critical predecessor of every event in a topological order, returned in order. */
+static Event **forward(Process *processes, size_t processes_count, size_t events_count) {
+    Event **order = malloc(sizeof(Event *) * (events_count + 1));
+    if (order == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    for (size_t n = 0; n < events_count; n++) {
+        // the earliest event whose predecessors are done, the order of the run where the clocks agree
+        Event *event = NULL;
+        Process *process = NULL;
+        for (size_t i = 0; i < processes_count; i++) {
+            if (processes[i].next == processes[i].count) {
+                continue;
+            }
+            Event *candidate = &processes[i].events[processes[i].next];
+            bool is_ready = candidate->is_send || candidate->match == NULL || candidate->match->done;
+            if (is_ready && (event == NULL || candidate->time < event->time)) {
+                event = candidate;
+                process = &processes[i];
+            }
+        }
+        if (event == NULL) {
+            fprintf(stderr, "Messages form a cycle, the traces are inconsistent\n");
+            free(order);
+            return NULL;
+        }
+        process->next++;
+
+        event->ready = process->start;
+        event->critical = NULL;
+        if (event->prev != NULL) {
+            event->ready = event->prev->time;
+            event->critical = event->prev;
+        }
+        if (!event->is_send && event->match != NULL && event->match->time > event->ready) {
+            event->ready = event->match->time;
+            event->critical = event->match;
+        }
+        event->done = true;
+        order[n] = event;
+    }
+    return order;
+}
+
+/** Latest time of every event, in reverse topological order. */
+static void backward(Event **order, size_t events_count, double end) {
+    for (size_t n = events_count; n-- > 0;) {
+        Event *event = order[n];
+        event->latest = DBL_MAX;
+        if (event->next != NULL) {
+            event->latest = event->next->latest - work(event->next);
+        }
+        if (event->is_send && event->match != NULL && event->match->latest - work(event->match) < event->latest) {
+            event->latest = event->match->latest - work(event->match);
+        }
+        if (event->latest == DBL_MAX) {
+            event->latest = end;
+        }
+    }
+}
+
+static void print_event(const Event *event, const char *edge, double edge_us) {
+    char buffer[16];
+    const MsgTraceRecord *record = event->record;
+    printf("%12.3f us  proc %d  %s %s %s %d, local_time=%d", event->time, event->process,
+           event->is_send ? "send" : "receive", type_name(record->type, buffer), event->is_send ? "to" : "from",
+           event->is_send ? record->dst : record->src, record->lamport);
+    printf("  +%.3f us %s\n", edge_us, edge);
+}
+
+int main(int argc, char *argv[]) {
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt != 'v') {
+            fprintf(stderr, "Usage: %s [-v] msgtrace.*.bin\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        verbose = true;
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-v] msgtrace.*.bin\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t processes_count = argc - optind;
+    TraceFile *files = calloc(processes_count, sizeof(TraceFile));
+    Process *processes = calloc(processes_count, sizeof(Process));
+    if (files == NULL || processes == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < processes_count; i++) {
+        if (trace_file_load(argv[optind + i], &files[i]) != 0) {
+            return EXIT_FAILURE;
+        }
+        if (files[i].overwritten) {
+            // the matching of messages counts from the first one of every channel
+            fprintf(stderr, "%s: the ring is incomplete, trace a shorter run\n", argv[optind + i]);
+            return EXIT_FAILURE;
+        }
+        for (size_t j = 0; j < i; j++) {
+            if (files[j].header.process == files[i].header.process) {
+                fprintf(stderr, "%s: process %d is traced twice\n", argv[optind + i], files[i].header.process);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    double ns_per_tick = trace_files_ns_per_tick(files, processes_count);
+    if (ns_per_tick == 0) {
+        fprintf(stderr, "No trace was closed, times are in ticks\n");
+        ns_per_tick = 1;
+    }
+    uint64_t origin = trace_files_origin(files, processes_count)->header.tsc_start;
+
+    size_t events_count = 0;
+    for (size_t i = 0; i < processes_count; i++) {
+        Process *process = &processes[i];
+        process->file = &files[i];
+        process->count = files[i].count;
+        process->start = ((double) files[i].header.tsc_start - (double) origin) * ns_per_tick / 1000.0;
+        process->events = calloc(process->count + 1, sizeof(Event));
+        if (process->events == NULL) {
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+        for (size_t j = 0; j < process->count; j++) {
+            Event *event = &process->events[j];
+            event->record = &files[i].records[j];
+            event->process = files[i].header.process;
+            event->slot = i;
+            event->is_send = event->record->src == event->process;
+            event->time = ((double) event->record->tsc - (double) origin) * ns_per_tick / 1000.0;
+            event->prev = j > 0 ? &process->events[j - 1] : NULL;
+            event->next = j + 1 < process->count ? &process->events[j + 1] : NULL;
+        }
+        events_count += process->count;
+    }
+    if (events_count == 0) {
+        fprintf(stderr, "No messages were traced\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < processes_count; i++) {
+        for (size_t j = 0; j < processes_count; j++) {
+            if (i != j && match_channel(&processes[i], &processes[j]) != 0) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    Event **order = forward(processes, processes_count, events_count);
+    if (order == NULL) {
+        return EXIT_FAILURE;
+    }
+    Event *last = order[0];
+    for (size_t n = 1; n < events_count; n++) {
+        if (order[n]->time > last->time) {
+            last = order[n];
+        }
+    }
+    backward(order, events_count, last->time);
+
+    // walk back from the last event through the predecessors it waited for
+    size_t path_length = 0;
+    size_t messages = 0;
+    double transport = 0;
+    Event *first = last;
+    for (Event *event = last; event != NULL; event = event->critical) {
+        event->on_path = true;
+        path_length++;
+        first = event;
+        processes[event->slot].path_events++;
+        if (event->critical != NULL && event->critical == event->match) {
+            transport += work(event);
+            messages++;
+        } else {
+            processes[event->slot].path_local += work(event);
+        }
+    }
+    double total = last->time - first->ready;
+
+    printf("critical path: %.3f us, %zu events, %zu messages, local_time %d..%d, ends at proc %d\n",
+           total, path_length, messages, first->record->lamport, last->record->lamport, last->process);
+    printf("  transport   %12.3f us  %5.1f%%", transport, total > 0 ? 100 * transport / total : 0);
+    if (messages > 0) {
+        printf("  %.3f us per message", transport / messages);
+    }
+    printf("\n");
+    for (size_t i = 0; i < processes_count; i++) {
+        if (processes[i].path_events > 0) {
+            printf("  local %-4d  %12.3f us  %5.1f%%\n", processes[i].file->header.process, processes[i].path_local,
+                   total > 0 ? 100 * processes[i].path_local / total : 0);
+        }
+    }
+
+    printf("\nproc  events  on path  min slack us  mean slack us\n");
+    for (size_t i = 0; i < processes_count; i++) {
+        Process *process = &processes[i];
+        double min_slack = DBL_MAX;
+        double sum_slack = 0;
+        for (size_t j = 0; j < process->count; j++) {
+            double slack = process->events[j].latest - process->events[j].time;
+            sum_slack += slack;
+            if (slack < min_slack) {
+                min_slack = slack;
+            }
+        }
+        if (process->count == 0) {
+            printf("%4d  %6d  %7d  %12s  %13s\n", process->file->header.process, 0, 0, "-", "-");
+            continue;
+        }
+        printf("%4d  %6zu  %7zu  %12.3f  %13.3f\n", process->file->header.process, process->count,
+               process->path_events, min_slack, sum_slack / process->count);
+    }
+
+    if (verbose) {
+        printf("\n%12.3f us  proc %d  start\n", first->ready, first->process);
+        for (size_t n = 0; n < events_count; n++) {
+            Event *event = order[n];
+            if (event->on_path) {
+                bool is_transport = event->critical != NULL && event->critical == event->match;
+                print_event(event, is_transport ? "transport" : "local", work(event));
+            }
+        }
+    }
+
+    free(order);
+    for (size_t i = 0; i < processes_count; i++) {
+        free(processes[i].events);
+        trace_file_free(&files[i]);
+    }
+    free(processes);
+    free(files);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+/**
+ * Fast build of libruntime.so for benchmarking. It interposes nothing: read,
+ * write and fork go straight to libc and print is a single write. The
+ * physical time counts the TRANSFERs sent by the parent like the checking
+ * build, but the labs report them through runtime_sent from their send
+ * instead of a hook on write.
+ */
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "banking.h"
+#include "pa2345.h"
+
+static struct {
+    bool silent;
+    int32_t *physical_time; ///< shared
+} runtime;
+
+__attribute__((constructor)) static void init(void) {
+    runtime.silent = getenv("PA45_SILENT") != NULL;
+    runtime.physical_time = mmap(NULL, sizeof(int32_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (runtime.physical_time == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    *runtime.physical_time = 0;
+}
+
+void runtime_sent(local_id from, const Message *msg) {
+    if (from == PARENT_ID && msg->s_header.s_type == TRANSFER) {
+        ++*runtime.physical_time;
+    }
+}
+
+void print(const char *s) {
+    if (runtime.silent) {
+        return;
+    }
+    size_t length = strlen(s);
+    while (length > 0) {
+        ssize_t written = write(STDERR_FILENO, s, length);
+        if (written <= 0) {
+            return;
+        }
+        s += written;
+        length -= written;
+    }
+}
+
+timestamp_t get_physical_time() {
+    return (timestamp_t) *runtime.physical_time;
+}
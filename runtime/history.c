@@ -0,0 +1,125 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "banking.h"
+
+typedef struct {
+    int balance;
+    int pending;
+} Cell;
+
+static const char *const first_column_header = "Proc \\ time |";
+
+static void format_cell(char *buffer, const Cell *cell, bool has_pending) {
+    if (has_pending) {
+        sprintf(buffer, " %d (%d) ", cell->balance, cell->pending);
+    } else {
+        sprintf(buffer, " %d ", cell->balance);
+    }
+}
+
+/** Same table as the prebuilt libruntime.so: a row per process, a column per time and totals last. */
+void print_history(const AllHistory *history) {
+    if (history == NULL) {
+        fprintf(stderr, "print_history: history is NULL!\n");
+        exit(1);
+    }
+
+    // rows are process ids from 1, the last one holds the totals
+    int rows = history->s_history_len + 2;
+    Cell (*table)[MAX_T + 1] = calloc(rows, sizeof(*table));
+    if (table == NULL) {
+        perror("calloc");
+        return;
+    }
+    int max_time = 0;
+    bool has_pending = false;
+    for (int i = 0; i < history->s_history_len; i++) {
+        const BalanceHistory *balance_history = &history->s_history[i];
+        if (balance_history->s_id < 1 || balance_history->s_id >= rows - 1) {
+            continue;
+        }
+        for (int j = 0; j < balance_history->s_history_len; j++) {
+            const BalanceState *state = &balance_history->s_history[j];
+            if (max_time < state->s_time) {
+                max_time = state->s_time;
+            }
+            if (state->s_time < 0 || state->s_time > MAX_T) {
+                continue;
+            }
+            table[balance_history->s_id][state->s_time] = (Cell) {
+                    .balance = state->s_balance,
+                    .pending = state->s_balance_pending_in
+            };
+            if (state->s_balance_pending_in > 0) {
+                has_pending = true;
+            }
+        }
+    }
+    if (max_time > MAX_T) {
+        fprintf(stderr, "print_history: max value of s_time: %d, expected s_time < %d!\n", max_time, MAX_T);
+        free(table);
+        return;
+    }
+    for (int t = 0; t <= max_time; t++) {
+        int sum = 0;
+        for (int id = 1; id <= history->s_history_len; id++) {
+            sum += table[id][t].balance + table[id][t].pending;
+        }
+        table[rows - 1][t] = (Cell) {.balance = sum};
+    }
+
+    fflush(stderr);
+    fflush(stdout);
+
+    char buffer[64];
+    int cell_width = 0;
+    for (int id = 1; id <= history->s_history_len; id++) {
+        for (int t = 0; t <= max_time; t++) {
+            format_cell(buffer, &table[id][t], has_pending);
+            int width = (int) strlen(buffer);
+            if (cell_width < width) {
+                cell_width = width;
+            }
+        }
+    }
+    size_t dashes = strlen(first_column_header) + (size_t) (cell_width + 1) * (max_time + 1) + 1;
+    char *hline = malloc(dashes + 2);
+    if (hline == NULL) {
+        perror("malloc");
+        free(table);
+        return;
+    }
+    memset(hline, '-', dashes);
+    strcpy(hline + dashes, "\n");
+
+    printf(has_pending ? "\nFull balance history for time range [0;%d], $balance ($pending):\n"
+                       : "\nFull balance history for time range [0;%d], $balance:\n", max_time);
+    fputs(hline, stdout);
+    printf("%s ", first_column_header);
+    for (int t = 0; t <= max_time; t++) {
+        printf("%*d |", cell_width - 1, t);
+    }
+    printf("\n");
+    fputs(hline, stdout);
+    for (int id = 1; id <= history->s_history_len; id++) {
+        printf("%11d | ", id);
+        for (int t = 0; t <= max_time; t++) {
+            format_cell(buffer, &table[id][t], has_pending);
+            printf("%*s|", cell_width, buffer);
+        }
+        printf("\n");
+        fputs(hline, stdout);
+    }
+    printf("      Total | ");
+    for (int t = 0; t <= max_time; t++) {
+        printf("%*d |", cell_width - 1, table[rows - 1][t].balance);
+    }
+    printf("\n");
+    fputs(hline, stdout);
+
+    free(hline);
+    free(table);
+}
@@ -0,0 +1,102 @@
+/**
+ * Decode the msgtrace.<id>.bin rings written by pa3 -M or pa5 --msg-trace into the
+ * text form of pa_rt_debug.log, records of all files merged by time:
+ *
+ *   proc 1: [12.345 us] send to 2 { local_time=3, payload_len=4, type=6, ... }
+ *
+ * The brackets hold the time since the earliest trace was opened where
+ * PA_RT_DEBUG prints the vector time.
+ *
+ * usage: msgtrace_decode msgtrace.*.bin
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "banking.h"
+#include "msgtrace_file.h"
+
+static void print_record(const TraceFile *file, const MsgTraceRecord *record, double us) {
+    local_id self = file->header.process;
+    bool is_received = record->dst == self;
+    printf("proc %d: [%.3f us] ", self, us);
+    printf(is_received ? "receive from %d { " : "send to %d { ", is_received ? record->src : record->dst);
+    printf("local_time=%d, payload_len=%d, type=%d", record->lamport, record->payload_len, record->type);
+
+    size_t prefix = record->payload_len < MSGTRACE_PAYLOAD_PREFIX ? record->payload_len : MSGTRACE_PAYLOAD_PREFIX;
+    switch (record->type) {
+        case STARTED:
+        case DONE: {
+            size_t length = prefix;
+            while (length > 0 && (record->payload[length - 1] == '\0' || record->payload[length - 1] == '\n')) {
+                length--;
+            }
+            printf(", '%.*s%s'", (int) length, record->payload, prefix < record->payload_len ? "..." : "");
+            break;
+        }
+        case TRANSFER: {
+            TransferOrder order;
+            if (prefix >= sizeof(order)) {
+                memcpy(&order, record->payload, sizeof(order));
+                printf(", { src=%d, dst=%d, amount=%d }", order.s_src, order.s_dst, order.s_amount);
+            }
+            break;
+        }
+        case BALANCE_HISTORY:
+            if (prefix >= 2) {
+                printf(", { id=%d, nchanges=%d }", (int8_t) record->payload[0], (uint8_t) record->payload[1]);
+            }
+            break;
+        default:
+            break;
+    }
+    printf(" }\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s msgtrace.*.bin\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t files_count = argc - 1;
+    TraceFile *files = calloc(files_count, sizeof(TraceFile));
+    size_t *next = calloc(files_count, sizeof(size_t));   // merge position in each file
+    if (files == NULL || next == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < files_count; i++) {
+        if (trace_file_load(argv[i + 1], &files[i]) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    double ns_per_tick = trace_files_ns_per_tick(files, files_count);
+    if (ns_per_tick == 0) {
+        fprintf(stderr, "No trace was closed, times are in ticks\n");
+        ns_per_tick = 1;
+    }
+    const MsgTraceHeader *start = &trace_files_origin(files, files_count)->header;
+
+    for (;;) {
+        size_t first = files_count;
+        for (size_t i = 0; i < files_count; i++) {
+            if (next[i] < files[i].count
+                && (first == files_count || files[i].records[next[i]].tsc < files[first].records[next[first]].tsc)) {
+                first = i;
+            }
+        }
+        if (first == files_count) {
+            break;
+        }
+        const MsgTraceRecord *record = &files[first].records[next[first]++];
+        print_record(&files[first], record, ((double) record->tsc - (double) start->tsc_start) * ns_per_tick / 1000.0);
+    }
+
+    for (size_t i = 0; i < files_count; i++) {
+        trace_file_free(&files[i]);
+    }
+    free(next);
+    free(files);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msgtrace_file.h"
+
+int trace_file_load(const char *path, TraceFile *file) {
+    FILE *fd = fopen(path, "rb");
+    if (fd == NULL) {
+        perror(path);
+        return -1;
+    }
+    char header[MSGTRACE_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, fd) != 1) {
+        fprintf(stderr, "%s: truncated header\n", path);
+        fclose(fd);
+        return -1;
+    }
+    memcpy(&file->header, header, sizeof(file->header));
+    if (file->header.magic != MSGTRACE_MAGIC || file->header.version != MSGTRACE_VERSION
+        || file->header.capacity == 0) {
+        fprintf(stderr, "%s: not a msgtrace file\n", path);
+        fclose(fd);
+        return -1;
+    }
+
+    uint64_t capacity = file->header.capacity;
+    uint64_t head = file->header.head;
+    MsgTraceRecord *ring = malloc(sizeof(MsgTraceRecord) * capacity);
+    if (ring == NULL || fread(ring, sizeof(MsgTraceRecord), capacity, fd) != capacity) {
+        fprintf(stderr, "%s: truncated ring\n", path);
+        free(ring);
+        fclose(fd);
+        return -1;
+    }
+    fclose(fd);
+    file->overwritten = head > capacity;
+    if (file->overwritten) {
+        fprintf(stderr, "%s: %lu oldest records were overwritten\n", path, (unsigned long) (head - capacity));
+    }
+
+    // unroll the ring so that readers see it in order
+    file->count = file->overwritten ? capacity : head;
+    file->records = malloc(sizeof(MsgTraceRecord) * (file->count + 1));
+    if (file->records == NULL) {
+        perror("malloc");
+        free(ring);
+        return -1;
+    }
+    for (size_t i = 0; i < file->count; i++) {
+        file->records[i] = ring[(head - file->count + i) % capacity];
+    }
+    free(ring);
+    return 0;
+}
+
+void trace_file_free(TraceFile *file) {
+    free(file->records);
+    file->records = NULL;
+}
+
+double trace_files_ns_per_tick(const TraceFile *files, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const MsgTraceHeader *header = &files[i].header;
+        if (header->tsc_end > header->tsc_start) {
+            return (double) (header->ns_end - header->ns_start) / (double) (header->tsc_end - header->tsc_start);
+        }
+    }
+    return 0;
+}
+
+const TraceFile *trace_files_origin(const TraceFile *files, size_t count) {
+    const TraceFile *origin = &files[0];
+    for (size_t i = 1; i < count; i++) {
+        if (files[i].header.ns_start < origin->header.ns_start) {
+            origin = &files[i];
+        }
+    }
+    return origin;
+}
@@ -0,0 +1,30 @@
+#ifndef PROGRAM_MSGTRACE_FILE_H
+#define PROGRAM_MSGTRACE_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "msgtrace.h"
+
+/** The ring of one msgtrace.<id>.bin, unrolled. */
+typedef struct {
+    MsgTraceHeader header;
+    MsgTraceRecord *records;  ///< oldest first
+    size_t count;
+    bool overwritten;         ///< the ring lost its oldest records
+} TraceFile;
+
+int trace_file_load(const char *path, TraceFile *file);
+
+void trace_file_free(TraceFile *file);
+
+/**
+ * Nanoseconds per tsc tick from the first trace that was closed, the counter
+ * is the same on every core. 0 if no process closed its trace.
+ */
+double trace_files_ns_per_tick(const TraceFile *files, size_t count);
+
+/** The trace opened first, its tsc_start is the origin of time. */
+const TraceFile *trace_files_origin(const TraceFile *files, size_t count);
+
+#endif //PROGRAM_MSGTRACE_FILE_H
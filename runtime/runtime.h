@@ -0,0 +1,35 @@
+#ifndef PROGRAM_RUNTIME_H
+#define PROGRAM_RUNTIME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ipc.h"
+
+/*
+ * Symbols the checking build exports besides the ones in pa2345.h and
+ * banking.h, with the names and arguments of the prebuilt libruntime.so.
+ * Nothing in the labs calls them.
+ */
+
+enum {
+    VECTOR_TIME_RT = 100, ///< message type of the vector time sent ahead of a message in debug mode
+    MAX_PROCS = 100,      ///< entries of the vector time
+    MAX_FDS = 500,
+    UNKNOWN_FD = -1,
+    STRACE_SLEEP_US = 1000,
+    WRITE_DELAY_US = 1000
+};
+
+void fill_header(MessageHeader *header, MessageType type, size_t payload_len);
+
+/** Send the vector time of the process to fd as a VECTOR_TIME_RT message. */
+int send_vtime(int fd);
+
+/** Read the payload of a VECTOR_TIME_RT message and merge it into the vector time. */
+int receive_vtime(int fd, const MessageHeader *header);
+
+/** Append a send or receive of msg to pa_rt_debug.log. */
+void print_event_msg(const Message *msg, bool is_received, int another_proc);
+
+#endif //PROGRAM_RUNTIME_H